@@ -0,0 +1,536 @@
+﻿/**
+ * @file PerlinNoise3D.h
+ * @brief CPU-ядро 3D-шума Перлина: fade/grad/lerp, PerlinNoise3D с пакетными
+ *        SIMD-ветками и многопоточное запекание объёма.
+ *
+ * Общий код для Project.cpp и микробенчмарка bench/NoiseBench.cpp; зависит
+ * только от стандартной библиотеки.
+ */
+#pragma once
+
+#include <vector>
+#include <numeric>
+#include <random>
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <cstddef>
+#include <cstdint>
+
+// SIMD для пакетного PerlinNoise3D::noise: SSE2/AVX2 на x86, NEON на ARM64.
+// AVX2 выбирается во время выполнения, поэтому сборка не требует /arch:AVX2.
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NOISE_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define NOISE_TARGET_AVX2
+#else
+#define NOISE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define NOISE_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+// The SIMD paths are bit-exact only while the scalar fade()/lerp() are not fused into
+// FMA either (GCC, and MSVC for ARM64, may fuse by default). MSVC and clang obey the pragmas
+// below; GCC has no pragma for it and needs -ffp-contract=off, see bench/CMakeLists.txt
+#if defined(_MSC_VER) && !defined(__clang__)
+#pragma fp_contract(off)
+#elif defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#endif
+
+/**
+ * @class PerlinNoise3D
+ * @brief Класс для генерации 3D-шума Перлина.
+ *
+ * Использует перестановочный массив (permutation table) и градиентные функции
+ * для создания непрерывного, плавного шума в трёхмерном пространстве.
+ * Используется для заполнения 3D-текстуры, передаваемой в шейдер.
+ */
+inline float fade(float t) { return t * t * t * (t * (t * 6 - 15) + 10); }
+inline float lerp(float a, float b, float t) { return a + t * (b - a); }
+inline float grad(int hash, float x, float y, float z) {
+    int h = hash & 15;
+    float u = h < 8 ? x : y;
+    float v = h < 4 ? y : (h == 12 || h == 14 ? x : z);
+    return ((h & 1) ? -u : u) + ((h & 2) ? -v : v);
+}
+
+// 32 gradients of 4D Perlin noise: the edge midpoints of a tesseract, one axis dropped
+inline float grad(int hash, float x, float y, float z, float w) {
+    int h = hash & 31;
+    float a = h < 24 ? x : y;
+    float b = h < 16 ? y : z;
+    float c = h < 8 ? z : w;
+    return ((h & 1) ? -a : a) + ((h & 2) ? -b : b) + ((h & 4) ? -c : c);
+}
+
+#if NOISE_SIMD_X86
+inline bool cpuHasAVX2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int r[4];
+    __cpuid(r, 0);
+    if (r[0] < 7) return false;
+    __cpuid(r, 1);
+    bool osxsave = (r[2] & (1 << 27)) != 0;
+    bool avx = (r[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(r, 7, 0);
+    return (r[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+class PerlinNoise3D {
+public:
+    /**
+     * @param seed — зерно перестановки
+     * @param period — период решётки в ячейках (1..256). При 256 шум совпадает
+     *        с классическим; меньший период делает его бесшовно тайлящимся.
+     */
+    PerlinNoise3D(unsigned int seed = 237, int period = 256)
+        : period(std::min(std::max(period, 1), 256)) {
+        p.resize(256);
+        std::iota(p.begin(), p.end(), 0);
+        std::default_random_engine engine(seed);
+        std::shuffle(p.begin(), p.end(), engine);
+        p.insert(p.end(), p.begin(), p.end());
+    }
+
+    float noise(float x, float y, float z) const {
+        int X = wrap((int)floor(x)), X1 = next(X);
+        int Y = wrap((int)floor(y)), Y1 = next(Y);
+        int Z = wrap((int)floor(z)), Z1 = next(Z);
+
+        x -= floor(x);
+        y -= floor(y);
+        z -= floor(z);
+
+        float u = fade(x), v = fade(y), w = fade(z);
+        int A = p[X] + Y, AA = p[A] + Z, AB = p[p[X] + Y1] + Z;
+        int B = p[X1] + Y, BA = p[B] + Z, BB = p[p[X1] + Y1] + Z;
+        int dz = Z1 - Z;
+
+        return lerp(
+            lerp(
+                lerp(grad(p[AA], x, y, z), grad(p[BA], x - 1, y, z), u),
+                lerp(grad(p[AB], x, y - 1, z), grad(p[BB], x - 1, y - 1, z), u),
+                v),
+            lerp(
+                lerp(grad(p[AA + dz], x, y, z - 1), grad(p[BA + dz], x - 1, y, z - 1), u),
+                lerp(grad(p[AB + dz], x, y - 1, z - 1), grad(p[BB + dz], x - 1, y - 1, z - 1), u),
+                v),
+            w);
+    }
+
+    /**
+     * @brief Пакетный вариант noise() для строки точек с общими y и z.
+     *
+     * out[i] = noise(x[i], y, z). Векторные ветки повторяют скалярную
+     * формулу операция в операцию (без FMA), поэтому результат побитово
+     * совпадает со скалярным путём — пока компилятор не сливает в FMA и его
+     * (fp-contract выключен, см. начало файла).
+     */
+    void noise(const float* x, float y, float z, float* out, int count) const {
+        Row r;
+        r.Y = wrap((int)floor(y));
+        r.Y1 = next(r.Y);
+        r.Z = wrap((int)floor(z));
+        r.dz = next(r.Z) - r.Z;
+        r.y = y - (float)floor(y);
+        r.z = z - (float)floor(z);
+        r.v = fade(r.y);
+        r.w = fade(r.z);
+
+        int i = 0;
+#if NOISE_SIMD_X86
+        static const bool avx2 = cpuHasAVX2();
+        if (avx2) i = noiseAVX2(x, r, out, count);
+        i += noiseSSE2(x + i, r, out + i, count - i);
+#elif NOISE_SIMD_NEON
+        i = noiseNEON(x, r, out, count);
+#endif
+        for (; i < count; ++i)
+            out[i] = noise(x[i], y, z);
+    }
+
+    /**
+     * @brief 4D-шум для анимированного режима.
+     *
+     * x и y тайлятся с периодом решётки, z — со своим периодом zPeriod,
+     * а w (время) не периодичен: индекс ячейки по w перемешивается целочисленным
+     * хэшем, поэтому узор не повторяется и через часы работы.
+     */
+    float noise(float x, float y, float z, float w, int zPeriod) const {
+        int X = wrap((int)floor(x)), X1 = next(X);
+        int Y = wrap((int)floor(y)), Y1 = next(Y);
+        int Z = (((int)floor(z) % zPeriod) + zPeriod) % zPeriod, Z1 = Z + 1 == zPeriod ? 0 : Z + 1;
+        long long W = (long long)floor(w);
+        int hashW[2] = { timeHash(W), timeHash(W + 1) };
+
+        x -= floor(x);
+        y -= floor(y);
+        z -= floor(z);
+        w -= floor(w);
+
+        // Corner c has offsets (c & 1, c >> 1 & 1, c >> 2 & 1, c >> 3) along x, y, z, w
+        float n[16];
+        for (int c = 0; c < 16; ++c) {
+            int cx = c & 1, cy = c >> 1 & 1, cz = c >> 2 & 1, cw = c >> 3;
+            int h = p[p[p[p[cx ? X1 : X] + (cy ? Y1 : Y)] + (cz ? Z1 : Z)] + hashW[cw]];
+            n[c] = grad(h, x - cx, y - cy, z - cz, w - cw);
+        }
+        // Collapse one axis at a time: x, then y, z and w
+        float weights[4] = { fade(x), fade(y), fade(z), fade(w) };
+        for (int axis = 0, count = 16; axis < 4; ++axis, count /= 2)
+            for (int c = 0; c < count / 2; ++c)
+                n[c] = lerp(n[2 * c], n[2 * c + 1], weights[axis]);
+        return n[0];
+    }
+
+    /// Имя SIMD-бэкенда, который использует пакетный noise() на этой машине.
+    static const char* simdName() {
+#if NOISE_SIMD_X86
+        return cpuHasAVX2() ? "AVX2" : "SSE2";
+#elif NOISE_SIMD_NEON
+        return "NEON";
+#else
+        return "scalar";
+#endif
+    }
+
+    /// Таблица перестановок (512 элементов) — для переноса шума на GPU.
+    const std::vector<int>& permutation() const { return p; }
+
+    int latticePeriod() const { return period; }
+
+private:
+    // Corner hashes index p[] directly, so the z+1 corner is "hash + dz"
+    // where dz is 1, or 1 - period when the lattice wraps.
+    int wrap(int i) const { return ((i % period) + period) % period; }
+    int next(int i) const { return i + 1 == period ? 0 : i + 1; }
+
+    // Integer hash (lowbias32) of an unbounded lattice index, folded into the table range
+    static int timeHash(long long i) {
+        uint32_t h = (uint32_t)i ^ (uint32_t)(i >> 32);
+        h ^= h >> 16;
+        h *= 0x7feb352du;
+        h ^= h >> 15;
+        h *= 0x846ca68bu;
+        h ^= h >> 16;
+        return (int)(h & 255);
+    }
+
+    // Общие для строки части решётки: индексы и дробные координаты по y/z.
+    struct Row {
+        int Y, Y1, Z, dz;
+        float y, z, v, w;
+    };
+
+#if NOISE_SIMD_X86
+    static NOISE_TARGET_AVX2 __m256 fade8(__m256 t) {
+        __m256 t3 = _mm256_mul_ps(_mm256_mul_ps(t, t), t);
+        __m256 k = _mm256_sub_ps(_mm256_mul_ps(t, _mm256_set1_ps(6.0f)), _mm256_set1_ps(15.0f));
+        return _mm256_mul_ps(t3, _mm256_add_ps(_mm256_mul_ps(t, k), _mm256_set1_ps(10.0f)));
+    }
+
+    static NOISE_TARGET_AVX2 __m256 lerp8(__m256 a, __m256 b, __m256 t) {
+        return _mm256_add_ps(a, _mm256_mul_ps(t, _mm256_sub_ps(b, a)));
+    }
+
+    static NOISE_TARGET_AVX2 __m256 grad8(__m256i hash, __m256 x, __m256 y, __m256 z) {
+        __m256i h = _mm256_and_si256(hash, _mm256_set1_epi32(15));
+        __m256 hLt8 = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(8), h));
+        __m256 hLt4 = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(4), h));
+        __m256 hX = _mm256_castsi256_ps(_mm256_or_si256(
+            _mm256_cmpeq_epi32(h, _mm256_set1_epi32(12)), _mm256_cmpeq_epi32(h, _mm256_set1_epi32(14))));
+        __m256 u = _mm256_blendv_ps(y, x, hLt8);
+        __m256 v = _mm256_blendv_ps(_mm256_blendv_ps(z, x, hX), y, hLt4);
+        // Negation through the sign bit matches scalar unary minus exactly
+        u = _mm256_xor_ps(u, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(1)), 31)));
+        v = _mm256_xor_ps(v, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(2)), 30)));
+        return _mm256_add_ps(u, v);
+    }
+
+    NOISE_TARGET_AVX2 int noiseAVX2(const float* xs, const Row& r, float* out, int count) const {
+        const int* perm = p.data();
+        const __m256i one = _mm256_set1_epi32(1), periodI = _mm256_set1_epi32(period);
+        const __m256 periodF = _mm256_set1_ps((float)period), invPeriod = _mm256_set1_ps(1.0f / period);
+        const __m256i Y = _mm256_set1_epi32(r.Y), Y1 = _mm256_set1_epi32(r.Y1);
+        const __m256i Z = _mm256_set1_epi32(r.Z), dz = _mm256_set1_epi32(r.dz);
+        const __m256 y0 = _mm256_set1_ps(r.y), y1 = _mm256_set1_ps(r.y - 1);
+        const __m256 z0 = _mm256_set1_ps(r.z), z1 = _mm256_set1_ps(r.z - 1);
+        const __m256 v = _mm256_set1_ps(r.v), w = _mm256_set1_ps(r.w);
+
+        int i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m256 x = _mm256_loadu_ps(xs + i);
+            __m256 fx = _mm256_floor_ps(x);
+            // fx mod period; the division may be off by one, the compares fix it up
+            __m256 m = _mm256_sub_ps(fx, _mm256_mul_ps(_mm256_floor_ps(_mm256_mul_ps(fx, invPeriod)), periodF));
+            m = _mm256_add_ps(m, _mm256_and_ps(_mm256_cmp_ps(m, _mm256_setzero_ps(), _CMP_LT_OQ), periodF));
+            m = _mm256_sub_ps(m, _mm256_and_ps(_mm256_cmp_ps(m, periodF, _CMP_GE_OQ), periodF));
+            __m256i X = _mm256_cvttps_epi32(m);
+            __m256i X1 = _mm256_add_epi32(X, one);
+            X1 = _mm256_andnot_si256(_mm256_cmpeq_epi32(X1, periodI), X1);
+            __m256 x0 = _mm256_sub_ps(x, fx);
+            __m256 x1 = _mm256_sub_ps(x0, _mm256_set1_ps(1.0f));
+            __m256 u = fade8(x0);
+
+            __m256i pX = _mm256_i32gather_epi32(perm, X, 4);
+            __m256i pX1 = _mm256_i32gather_epi32(perm, X1, 4);
+            __m256i AA = _mm256_add_epi32(_mm256_i32gather_epi32(perm, _mm256_add_epi32(pX, Y), 4), Z);
+            __m256i AB = _mm256_add_epi32(_mm256_i32gather_epi32(perm, _mm256_add_epi32(pX, Y1), 4), Z);
+            __m256i BA = _mm256_add_epi32(_mm256_i32gather_epi32(perm, _mm256_add_epi32(pX1, Y), 4), Z);
+            __m256i BB = _mm256_add_epi32(_mm256_i32gather_epi32(perm, _mm256_add_epi32(pX1, Y1), 4), Z);
+
+            __m256 n = lerp8(
+                lerp8(
+                    lerp8(grad8(_mm256_i32gather_epi32(perm, AA, 4), x0, y0, z0),
+                          grad8(_mm256_i32gather_epi32(perm, BA, 4), x1, y0, z0), u),
+                    lerp8(grad8(_mm256_i32gather_epi32(perm, AB, 4), x0, y1, z0),
+                          grad8(_mm256_i32gather_epi32(perm, BB, 4), x1, y1, z0), u),
+                    v),
+                lerp8(
+                    lerp8(grad8(_mm256_i32gather_epi32(perm, _mm256_add_epi32(AA, dz), 4), x0, y0, z1),
+                          grad8(_mm256_i32gather_epi32(perm, _mm256_add_epi32(BA, dz), 4), x1, y0, z1), u),
+                    lerp8(grad8(_mm256_i32gather_epi32(perm, _mm256_add_epi32(AB, dz), 4), x0, y1, z1),
+                          grad8(_mm256_i32gather_epi32(perm, _mm256_add_epi32(BB, dz), 4), x1, y1, z1), u),
+                    v),
+                w);
+            _mm256_storeu_ps(out + i, n);
+        }
+        return i;
+    }
+
+    static __m128 select4(__m128 mask, __m128 a, __m128 b) {
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    }
+
+    // floor() without SSE4.1: truncate, step down for negatives, keep the sign of -0
+    static __m128 floor4(__m128 x) {
+        __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+        __m128 f = _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1.0f)));
+        return _mm_or_ps(f, _mm_and_ps(x, _mm_set1_ps(-0.0f)));
+    }
+
+    static __m128 fade4(__m128 t) {
+        __m128 t3 = _mm_mul_ps(_mm_mul_ps(t, t), t);
+        __m128 k = _mm_sub_ps(_mm_mul_ps(t, _mm_set1_ps(6.0f)), _mm_set1_ps(15.0f));
+        return _mm_mul_ps(t3, _mm_add_ps(_mm_mul_ps(t, k), _mm_set1_ps(10.0f)));
+    }
+
+    static __m128 lerp4(__m128 a, __m128 b, __m128 t) {
+        return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)));
+    }
+
+    static __m128 grad4(__m128i hash, __m128 x, __m128 y, __m128 z) {
+        __m128i h = _mm_and_si128(hash, _mm_set1_epi32(15));
+        __m128 hLt8 = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(8)));
+        __m128 hLt4 = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(4)));
+        __m128 hX = _mm_castsi128_ps(_mm_or_si128(
+            _mm_cmpeq_epi32(h, _mm_set1_epi32(12)), _mm_cmpeq_epi32(h, _mm_set1_epi32(14))));
+        __m128 u = select4(hLt8, x, y);
+        __m128 v = select4(hLt4, y, select4(hX, x, z));
+        u = _mm_xor_ps(u, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(1)), 31)));
+        v = _mm_xor_ps(v, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(2)), 30)));
+        return _mm_add_ps(u, v);
+    }
+
+    // SSE2 has no gather instruction, so table lookups go lane by lane
+    __m128i gather4(__m128i idx) const {
+        alignas(16) int i[4];
+        _mm_store_si128((__m128i*)i, idx);
+        return _mm_setr_epi32(p[i[0]], p[i[1]], p[i[2]], p[i[3]]);
+    }
+
+    int noiseSSE2(const float* xs, const Row& r, float* out, int count) const {
+        const __m128i one = _mm_set1_epi32(1), periodI = _mm_set1_epi32(period);
+        const __m128 periodF = _mm_set1_ps((float)period), invPeriod = _mm_set1_ps(1.0f / period);
+        const __m128i Y = _mm_set1_epi32(r.Y), Y1 = _mm_set1_epi32(r.Y1);
+        const __m128i Z = _mm_set1_epi32(r.Z), dz = _mm_set1_epi32(r.dz);
+        const __m128 y0 = _mm_set1_ps(r.y), y1 = _mm_set1_ps(r.y - 1);
+        const __m128 z0 = _mm_set1_ps(r.z), z1 = _mm_set1_ps(r.z - 1);
+        const __m128 v = _mm_set1_ps(r.v), w = _mm_set1_ps(r.w);
+
+        int i = 0;
+        for (; i + 4 <= count; i += 4) {
+            __m128 x = _mm_loadu_ps(xs + i);
+            __m128 fx = floor4(x);
+            __m128 m = _mm_sub_ps(fx, _mm_mul_ps(floor4(_mm_mul_ps(fx, invPeriod)), periodF));
+            m = _mm_add_ps(m, _mm_and_ps(_mm_cmplt_ps(m, _mm_setzero_ps()), periodF));
+            m = _mm_sub_ps(m, _mm_and_ps(_mm_cmpge_ps(m, periodF), periodF));
+            __m128i X = _mm_cvttps_epi32(m);
+            __m128i X1 = _mm_add_epi32(X, one);
+            X1 = _mm_andnot_si128(_mm_cmpeq_epi32(X1, periodI), X1);
+            __m128 x0 = _mm_sub_ps(x, fx);
+            __m128 x1 = _mm_sub_ps(x0, _mm_set1_ps(1.0f));
+            __m128 u = fade4(x0);
+
+            __m128i pX = gather4(X), pX1 = gather4(X1);
+            __m128i AA = _mm_add_epi32(gather4(_mm_add_epi32(pX, Y)), Z);
+            __m128i AB = _mm_add_epi32(gather4(_mm_add_epi32(pX, Y1)), Z);
+            __m128i BA = _mm_add_epi32(gather4(_mm_add_epi32(pX1, Y)), Z);
+            __m128i BB = _mm_add_epi32(gather4(_mm_add_epi32(pX1, Y1)), Z);
+
+            __m128 n = lerp4(
+                lerp4(
+                    lerp4(grad4(gather4(AA), x0, y0, z0), grad4(gather4(BA), x1, y0, z0), u),
+                    lerp4(grad4(gather4(AB), x0, y1, z0), grad4(gather4(BB), x1, y1, z0), u),
+                    v),
+                lerp4(
+                    lerp4(grad4(gather4(_mm_add_epi32(AA, dz)), x0, y0, z1),
+                          grad4(gather4(_mm_add_epi32(BA, dz)), x1, y0, z1), u),
+                    lerp4(grad4(gather4(_mm_add_epi32(AB, dz)), x0, y1, z1),
+                          grad4(gather4(_mm_add_epi32(BB, dz)), x1, y1, z1), u),
+                    v),
+                w);
+            _mm_storeu_ps(out + i, n);
+        }
+        return i;
+    }
+#elif NOISE_SIMD_NEON
+    static float32x4_t fade4(float32x4_t t) {
+        float32x4_t t3 = vmulq_f32(vmulq_f32(t, t), t);
+        float32x4_t k = vsubq_f32(vmulq_f32(t, vdupq_n_f32(6.0f)), vdupq_n_f32(15.0f));
+        return vmulq_f32(t3, vaddq_f32(vmulq_f32(t, k), vdupq_n_f32(10.0f)));
+    }
+
+    static float32x4_t lerp4(float32x4_t a, float32x4_t b, float32x4_t t) {
+        return vaddq_f32(a, vmulq_f32(t, vsubq_f32(b, a)));
+    }
+
+    static float32x4_t grad4(int32x4_t hash, float32x4_t x, float32x4_t y, float32x4_t z) {
+        int32x4_t h = vandq_s32(hash, vdupq_n_s32(15));
+        uint32x4_t hLt8 = vcltq_s32(h, vdupq_n_s32(8));
+        uint32x4_t hLt4 = vcltq_s32(h, vdupq_n_s32(4));
+        uint32x4_t hX = vorrq_u32(vceqq_s32(h, vdupq_n_s32(12)), vceqq_s32(h, vdupq_n_s32(14)));
+        float32x4_t u = vbslq_f32(hLt8, x, y);
+        float32x4_t v = vbslq_f32(hLt4, y, vbslq_f32(hX, x, z));
+        uint32x4_t hu = vreinterpretq_u32_s32(h);
+        u = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(u), vshlq_n_u32(vandq_u32(hu, vdupq_n_u32(1)), 31)));
+        v = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(v), vshlq_n_u32(vandq_u32(hu, vdupq_n_u32(2)), 30)));
+        return vaddq_f32(u, v);
+    }
+
+    int32x4_t gather4(int32x4_t idx) const {
+        int i[4];
+        vst1q_s32(i, idx);
+        int v[4] = { p[i[0]], p[i[1]], p[i[2]], p[i[3]] };
+        return vld1q_s32(v);
+    }
+
+    int noiseNEON(const float* xs, const Row& r, float* out, int count) const {
+        const int32x4_t one = vdupq_n_s32(1), periodI = vdupq_n_s32(period);
+        const float32x4_t periodF = vdupq_n_f32((float)period), invPeriod = vdupq_n_f32(1.0f / period);
+        const int32x4_t Y = vdupq_n_s32(r.Y), Y1 = vdupq_n_s32(r.Y1);
+        const int32x4_t Z = vdupq_n_s32(r.Z), dz = vdupq_n_s32(r.dz);
+        const float32x4_t y0 = vdupq_n_f32(r.y), y1 = vdupq_n_f32(r.y - 1);
+        const float32x4_t z0 = vdupq_n_f32(r.z), z1 = vdupq_n_f32(r.z - 1);
+        const float32x4_t v = vdupq_n_f32(r.v), w = vdupq_n_f32(r.w);
+
+        int i = 0;
+        for (; i + 4 <= count; i += 4) {
+            float32x4_t x = vld1q_f32(xs + i);
+            float32x4_t fx = vrndmq_f32(x);
+            float32x4_t m = vsubq_f32(fx, vmulq_f32(vrndmq_f32(vmulq_f32(fx, invPeriod)), periodF));
+            m = vaddq_f32(m, vreinterpretq_f32_u32(vandq_u32(vcltq_f32(m, vdupq_n_f32(0.0f)), vreinterpretq_u32_f32(periodF))));
+            m = vsubq_f32(m, vreinterpretq_f32_u32(vandq_u32(vcgeq_f32(m, periodF), vreinterpretq_u32_f32(periodF))));
+            int32x4_t X = vcvtq_s32_f32(m);
+            int32x4_t X1 = vaddq_s32(X, one);
+            X1 = vbicq_s32(X1, vreinterpretq_s32_u32(vceqq_s32(X1, periodI)));
+            float32x4_t x0 = vsubq_f32(x, fx);
+            float32x4_t x1 = vsubq_f32(x0, vdupq_n_f32(1.0f));
+            float32x4_t u = fade4(x0);
+
+            int32x4_t pX = gather4(X), pX1 = gather4(X1);
+            int32x4_t AA = vaddq_s32(gather4(vaddq_s32(pX, Y)), Z);
+            int32x4_t AB = vaddq_s32(gather4(vaddq_s32(pX, Y1)), Z);
+            int32x4_t BA = vaddq_s32(gather4(vaddq_s32(pX1, Y)), Z);
+            int32x4_t BB = vaddq_s32(gather4(vaddq_s32(pX1, Y1)), Z);
+
+            float32x4_t n = lerp4(
+                lerp4(
+                    lerp4(grad4(gather4(AA), x0, y0, z0), grad4(gather4(BA), x1, y0, z0), u),
+                    lerp4(grad4(gather4(AB), x0, y1, z0), grad4(gather4(BB), x1, y1, z0), u),
+                    v),
+                lerp4(
+                    lerp4(grad4(gather4(vaddq_s32(AA, dz)), x0, y0, z1),
+                          grad4(gather4(vaddq_s32(BA, dz)), x1, y0, z1), u),
+                    lerp4(grad4(gather4(vaddq_s32(AB, dz)), x0, y1, z1),
+                          grad4(gather4(vaddq_s32(BB, dz)), x1, y1, z1), u),
+                    v),
+                w);
+            vst1q_f32(out + i, n);
+        }
+        return i;
+    }
+#endif
+
+    int period;
+    std::vector<int> p;
+};
+
+/// Потоки для работы в фоне рядом с рендером: все ядра, кроме одного, и хотя бы один.
+/// hardware_concurrency() может вернуть 0, поэтому единица вычитается после max.
+inline unsigned backgroundThreadCount() { return std::max(2u, std::thread::hardware_concurrency()) - 1; }
+
+/**
+ * @brief Распределяет индексы [0, count) между рабочими потоками.
+ *
+ * Потоки забирают индексы из общего атомарного счётчика, так что
+ * неравномерная нагрузка балансируется сама. Вызывающий поток тоже работает.
+ *
+ * @param threads — число потоков (0 = hardware_concurrency)
+ */
+template <typename Fn>
+void parallelFor(int count, Fn&& fn, unsigned threads = 0) {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, (unsigned)std::max(count, 1));
+    std::atomic<int> next{ 0 };
+    auto worker = [&]() {
+        for (int i = next++; i < count; i = next++)
+            fn(i);
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; ++t)
+        pool.emplace_back(worker);
+    worker();
+    for (auto& t : pool)
+        t.join();
+}
+
+/**
+ * @brief Заполняет один z-срез объёма шума (size x size значений в [0, 1]).
+ *
+ * Строки по x считаются пакетным PerlinNoise3D::noise; результат побитово
+ * совпадает с поточечным вызовом скалярного noise().
+ */
+inline void bakeNoiseSlice(const PerlinNoise3D& perlin, int size, float frequency, int z, float* out) {
+    std::vector<float> xs(size);
+    for (int x = 0; x < size; ++x)
+        xs[x] = x * frequency;
+    for (int y = 0; y < size; ++y) {
+        float* row = out + (size_t)y * size;
+        perlin.noise(xs.data(), y * frequency, z * frequency, row, size);
+        for (int x = 0; x < size; ++x)
+            row[x] = 0.5f + 0.5f * row[x];
+    }
+}
+
+/**
+ * @brief Заполняет объём size³ (z-срезы подряд) в threads потоках.
+ *
+ * @param threads — число потоков (0 = hardware_concurrency)
+ */
+inline void bakeNoiseVolume(const PerlinNoise3D& perlin, int size, float frequency, float* out, unsigned threads = 0) {
+    parallelFor(size, [&](int z) {
+        bakeNoiseSlice(perlin, size, frequency, z, out + (size_t)z * size * size);
+    }, threads);
+}
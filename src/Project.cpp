@@ -35,240 +35,5800 @@
 #include <random>
 #include <cmath>
 #include <string>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <csignal>
+#include <memory>
+#include <deque>
+#include <map>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <functional>
+#include <filesystem>
+
+// Отображение файлов в память для кэша объёма шума
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// CPU-ядро шума (SIMD-ветки PerlinNoise3D выбираются в заголовке)
+#include "PerlinNoise3D.h"
 
 // GLAD должен быть ПЕРВЫМ OpenGL-заголовком!
 #include <glad/glad.h>
 
-// GLFW — после GLAD
-#define GLFW_NO_MAIN
-#include <GLFW/glfw3.h>
+// GLFW — после GLAD
+#define GLFW_NO_MAIN
+#include <GLFW/glfw3.h>
+
+// ---------- GL 4.x entry points ----------
+// glad сгенерирован только для 3.3 Core, поэтому функции более новых версий
+// объявляются здесь в стиле glad и загружаются в detectGLCaps(). Вызывающий
+// код обязан проверить соответствующий флаг GLCaps перед использованием.
+#ifndef GL_VERSION_4_3
+#define GL_COMPUTE_SHADER 0x91B9
+#define GL_TEXTURE_FETCH_BARRIER_BIT 0x00000008
+#define GL_TEXTURE_UPDATE_BARRIER_BIT 0x00000100
+#define GL_SHADER_IMAGE_ACCESS_BARRIER_BIT 0x00000020
+typedef void (APIENTRYP PFNGLDISPATCHCOMPUTEPROC)(GLuint num_groups_x, GLuint num_groups_y, GLuint num_groups_z);
+typedef void (APIENTRYP PFNGLBINDIMAGETEXTUREPROC)(GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format);
+typedef void (APIENTRYP PFNGLMEMORYBARRIERPROC)(GLbitfield barriers);
+PFNGLDISPATCHCOMPUTEPROC glad_glDispatchCompute = nullptr;
+PFNGLBINDIMAGETEXTUREPROC glad_glBindImageTexture = nullptr;
+PFNGLMEMORYBARRIERPROC glad_glMemoryBarrier = nullptr;
+#define glDispatchCompute glad_glDispatchCompute
+#define glBindImageTexture glad_glBindImageTexture
+#define glMemoryBarrier glad_glMemoryBarrier
+#endif
+
+#ifndef GL_VERSION_4_1
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+typedef void (APIENTRYP PFNGLGETPROGRAMBINARYPROC)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+typedef void (APIENTRYP PFNGLPROGRAMBINARYPROC)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+typedef void (APIENTRYP PFNGLPROGRAMPARAMETERIPROC)(GLuint program, GLenum pname, GLint value);
+PFNGLGETPROGRAMBINARYPROC glad_glGetProgramBinary = nullptr;
+PFNGLPROGRAMBINARYPROC glad_glProgramBinary = nullptr;
+PFNGLPROGRAMPARAMETERIPROC glad_glProgramParameteri = nullptr;
+#define glGetProgramBinary glad_glGetProgramBinary
+#define glProgramBinary glad_glProgramBinary
+#define glProgramParameteri glad_glProgramParameteri
+#endif
+
+#ifndef GL_VERSION_4_4
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+PFNGLBUFFERSTORAGEPROC glad_glBufferStorage = nullptr;
+#define glBufferStorage glad_glBufferStorage
+#endif
+
+#ifndef GL_KHR_parallel_shader_compile
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+PFNGLMAXSHADERCOMPILERTHREADSKHRPROC glad_glMaxShaderCompilerThreadsKHR = nullptr;
+#define glMaxShaderCompilerThreadsKHR glad_glMaxShaderCompilerThreadsKHR
+#endif
+
+#define GLSL(src) "#version 330 core\n" #src
+// Фрагмент GLSL без строки #version — для сборки шейдеров из общих частей
+#define GLSL_CODE(src) #src "\n"
+
+// ---------- GL State ----------
+/**
+ * @brief Кэш привязок: пропускает glUseProgram, glBindVertexArray,
+ * glActiveTexture и glBindTexture, если привязано то же самое.
+ *
+ * Весь рендер привязывает и удаляет программы, VAO и текстуры только через
+ * glState, поэтому кэш всегда совпадает с контекстом; начальные значения —
+ * состояние нового контекста. Кэш один на контекст: glState — кэш текущего,
+ * контексты переключаются через makeContextCurrent().
+ */
+class GLStateCache {
+public:
+    static const int maxUnits = 8;      // texture units used by the renderer
+
+    void useProgram(GLuint program) {
+        if (program == currentProgram) return;
+        glUseProgram(program);
+        currentProgram = program;
+    }
+
+    void bindVertexArray(GLuint vao) {
+        if (vao == currentVao) return;
+        glBindVertexArray(vao);
+        currentVao = vao;
+    }
+
+    void activeTexture(GLenum unit) {
+        if (unit == activeUnit) return;
+        glActiveTexture(unit);
+        activeUnit = unit;
+    }
+
+    /// Привязывает текстуру к активному блоку.
+    void bindTexture(GLenum target, GLuint texture) {
+        GLuint* bound = slot(target);
+        if (bound && *bound == texture) return;
+        glBindTexture(target, texture);
+        if (bound) *bound = texture;
+    }
+
+    void deleteProgram(GLuint program) {
+        if (program && program == currentProgram) currentProgram = unknown;
+        glDeleteProgram(program);
+        seenDeletions = ++sharedDeletions;
+    }
+
+    void deleteVertexArrays(GLsizei count, const GLuint* vaos) {
+        for (GLsizei i = 0; i < count; ++i)
+            if (vaos[i] && vaos[i] == currentVao) currentVao = unknown;
+        glDeleteVertexArrays(count, vaos);
+    }
+
+    /// Удалённые имена могут вернуться из glGen*, поэтому кэш их забывает.
+    void deleteTextures(GLsizei count, const GLuint* names) {
+        for (GLsizei i = 0; i < count; ++i)
+            for (auto& unit : textures)
+                for (GLuint& bound : unit)
+                    if (names[i] && bound == names[i]) bound = unknown;
+        glDeleteTextures(count, names);
+        seenDeletions = ++sharedDeletions;
+    }
+
+    /**
+     * @brief Забывает программы и текстуры, если их удаляли в другом контексте.
+     *
+     * Они общие для контекстов с общими объектами (--windows), и освобождённое
+     * имя может вернуться из glGen* уже другим объектом. VAO не разделяются,
+     * поэтому остаются в кэше.
+     */
+    void syncShared() {
+        if (seenDeletions == sharedDeletions) return;
+        currentProgram = unknown;
+        for (auto& unit : textures)
+            for (GLuint& bound : unit) bound = unknown;
+        seenDeletions = sharedDeletions;
+    }
+
+private:
+    static const GLuint unknown = ~0u;
+
+    GLuint* slot(GLenum target) {
+        int unit = (int)activeUnit - GL_TEXTURE0;
+        int index = target == GL_TEXTURE_1D ? 0 : target == GL_TEXTURE_2D ? 1 : target == GL_TEXTURE_3D ? 2
+                  : target == GL_TEXTURE_2D_ARRAY ? 3 : target == GL_TEXTURE_BUFFER ? 4 : -1;
+        if (unit < 0 || unit >= maxUnits || index < 0) return nullptr;
+        return &textures[unit][index];
+    }
+
+    GLuint currentProgram = 0;
+    GLuint currentVao = 0;
+    GLenum activeUnit = GL_TEXTURE0;
+    GLuint textures[maxUnits][5] = {};
+    unsigned long long seenDeletions = sharedDeletions;    // a fresh context has nothing stale
+    static inline unsigned long long sharedDeletions = 0;
+};
+
+GLStateCache glState;
+std::map<GLFWwindow*, GLStateCache> inactiveGLStates;
+
+/// Делает контекст окна текущим вместе с его кэшем привязок.
+void makeContextCurrent(GLFWwindow* window) {
+    GLFWwindow* previous = glfwGetCurrentContext();
+    if (previous == window) return;
+    if (previous) inactiveGLStates[previous] = glState;
+    auto it = inactiveGLStates.find(window);
+    glState = it != inactiveGLStates.end() ? it->second : GLStateCache();
+    glState.syncShared();
+    glfwMakeContextCurrent(window);
+}
+
+/// Забывает кэш привязок окна перед glfwDestroyWindow.
+void forgetContext(GLFWwindow* window) { inactiveGLStates.erase(window); }
+
+/**
+ * @brief Кольцо копий небольшого uniform-блока, который меняется каждый кадр.
+ *
+ * С GL 4.4 / ARB_buffer_storage буфер отображается один раз (persistent,
+ * coherent), а запись — memcpy в слот, который GPU уже прочитал: после
+ * команд каждого слота ставится fence, и перед повторной записью его
+ * дожидаются; если ожидание не удалось, кольцо переходит на путь 3.3.
+ * На 3.3 буфер «осиротляется» glBufferData(nullptr) и заполняется
+ * glBufferSubData — драйвер сам выдаёт свежую память, не дожидаясь GPU.
+ */
+class UniformRing {
+public:
+    static const int slotCount = 3;
+
+    UniformRing(GLuint binding, GLsizeiptr size, bool persistent) : binding(binding), size(size) {
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        stride = (size + alignment - 1) / alignment * alignment;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        if (persistent) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_UNIFORM_BUFFER, stride * slotCount, nullptr, flags);
+            mapped = (uint8_t*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, stride * slotCount, flags);
+        }
+        if (!mapped) {
+            glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_STREAM_DRAW);
+            glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    ~UniformRing() {
+        for (GLsync& fence : fences)
+            if (fence) glDeleteSync(fence);
+        if (mapped) {
+            glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+            glUnmapBuffer(GL_UNIFORM_BUFFER);
+        }
+        glDeleteBuffers(1, &buffer);
+    }
+
+    UniformRing(const UniformRing&) = delete;
+    UniformRing& operator=(const UniformRing&) = delete;
+
+    bool persistent() const { return mapped != nullptr; }
+
+    /// Пишет новые значения блока и привязывает их к binding.
+    void write(const void* data) {
+        if (!mapped) {
+            glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+            glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_STREAM_DRAW);
+            glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+            return;
+        }
+        // Everything issued since the last write read the current slot
+        if (slot >= 0)
+            fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot = (slot + 1) % slotCount;
+        if (fences[slot]) {
+            // The slot may be rewritten only once the GPU is done with it
+            GLenum status;
+            while ((status = glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 100000000)) == GL_TIMEOUT_EXPIRED) {}
+            if (status == GL_WAIT_FAILED) {
+                std::cerr << "Uniform ring: fence wait failed, falling back to orphaning" << std::endl;
+                dropPersistent();
+                write(data);
+                return;
+            }
+            glDeleteSync(fences[slot]);
+            fences[slot] = nullptr;
+        }
+        std::memcpy(mapped + stride * slot, data, (size_t)size);
+        glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, stride * slot, size);
+    }
+
+private:
+    /// Переходит на путь 3.3: immutable-буфер нельзя осиротить, поэтому он пересоздаётся.
+    void dropPersistent() {
+        for (GLsync& fence : fences)
+            if (fence) glDeleteSync(fence);
+        std::fill(std::begin(fences), std::end(fences), nullptr);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+        glDeleteBuffers(1, &buffer);
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        mapped = nullptr;
+        slot = -1;
+    }
+
+    GLuint binding;
+    GLsizeiptr size, stride = 0;
+    GLuint buffer = 0;
+    uint8_t* mapped = nullptr;
+    GLsync fences[slotCount] = {};
+    int slot = -1;
+};
+
+// ---------- Noise Texture Formats ----------
+/**
+ * @brief Формат хранения объёма шума в видеопамяти.
+ *
+ * R32F — эталон (64 МБ при 256³), R16F и R8 — в 2 и 4 раза меньше,
+ * BC4 (RGTC1) — 4 бита на тексель, сжимается послойно блоками 4x4.
+ */
+enum class NoiseFormat { R32F, R16F, R8, BC4 };
+
+struct NoiseFormatDesc {
+    NoiseFormat format;
+    const char* name;
+    GLenum internalFormat;
+    GLenum type;            // тип данных для glTexImage3D (0 для сжатых форматов)
+};
+
+const NoiseFormatDesc noiseFormats[] = {
+    { NoiseFormat::R32F, "r32f", GL_R32F, GL_FLOAT },
+    { NoiseFormat::R16F, "r16f", GL_R16F, GL_HALF_FLOAT },
+    { NoiseFormat::R8,   "r8",   GL_R8,   GL_UNSIGNED_BYTE },
+    { NoiseFormat::BC4,  "bc4",  GL_COMPRESSED_RED_RGTC1, 0 },
+};
+
+const NoiseFormatDesc& noiseFormatDesc(NoiseFormat format) {
+    return noiseFormats[(int)format];
+}
+
+bool parseNoiseFormat(const std::string& name, NoiseFormat& format) {
+    for (const NoiseFormatDesc& desc : noiseFormats) {
+        if (name == desc.name) {
+            format = desc.format;
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Размер одного z-среза size x size в байтах для заданного формата.
+size_t noiseSliceBytes(int size, NoiseFormat format) {
+    size_t texels = (size_t)size * size;
+    switch (format) {
+    case NoiseFormat::R32F: return texels * 4;
+    case NoiseFormat::R16F: return texels * 2;
+    case NoiseFormat::R8:   return texels;
+    case NoiseFormat::BC4:  return (size_t)((size + 3) / 4) * ((size + 3) / 4) * 8;
+    }
+    return 0;
+}
+
+/// float → half (IEEE 754 binary16) с округлением к ближайшему чётному.
+uint16_t floatToHalf(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t mant = x & 0x7fffff;
+    int rawExp = (x >> 23) & 0xff;
+    if (rawExp == 0xff) return (uint16_t)(sign | 0x7c00 | (mant ? 0x200 : 0));
+
+    int exp = rawExp - 127 + 15;
+    if (exp >= 31) return (uint16_t)(sign | 0x7c00);
+    if (exp <= 0) {
+        if (exp < -10) return (uint16_t)sign;
+        mant |= 0x800000;
+        int shift = 14 - exp;
+        uint32_t half = mant >> shift;
+        uint32_t rem = mant & ((1u << shift) - 1);
+        uint32_t mid = 1u << (shift - 1);
+        if (rem > mid || (rem == mid && (half & 1))) half++;
+        return (uint16_t)(sign | half);
+    }
+    uint32_t half = sign | ((uint32_t)exp << 10) | (mant >> 13);
+    uint32_t rem = mant & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (half & 1))) half++;
+    return (uint16_t)half;
+}
+
+float halfToFloat(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    if (exp == 0) {
+        float v = std::ldexp((float)mant, -24);
+        return sign ? -v : v;
+    }
+    uint32_t x = sign | (exp == 31 ? 0x7f800000 | (mant << 13) : ((exp + 112) << 23) | (mant << 13));
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+/**
+ * @brief Сжимает один срез size x size в блоки BC4 (RGTC1 UNORM).
+ *
+ * Простой кодер: концы палитры — min/max блока, каждому текселю
+ * назначается ближайший из 8 интерполированных уровней.
+ */
+void encodeBC4Slice(const float* src, int size, uint8_t* dst) {
+    int blocks = (size + 3) / 4;
+    for (int by = 0; by < blocks; ++by) {
+        for (int bx = 0; bx < blocks; ++bx) {
+            int texel[16];
+            int lo = 255, hi = 0;
+            for (int i = 0; i < 16; ++i) {
+                int x = std::min(bx * 4 + (i & 3), size - 1);
+                int y = std::min(by * 4 + (i >> 2), size - 1);
+                float v = std::min(std::max(src[(size_t)y * size + x], 0.0f), 1.0f);
+                texel[i] = (int)std::lround(v * 255.0f);
+                lo = std::min(lo, texel[i]);
+                hi = std::max(hi, texel[i]);
+            }
+
+            // red0 > red1 selects the 8-level palette
+            int palette[8] = { hi, lo };
+            for (int k = 1; k <= 6; ++k)
+                palette[k + 1] = ((7 - k) * hi + k * lo + 3) / 7;
+
+            uint64_t bits = 0;
+            for (int i = 0; i < 16; ++i) {
+                int best = 0;
+                if (hi != lo) {
+                    for (int k = 1; k < 8; ++k)
+                        if (std::abs(palette[k] - texel[i]) < std::abs(palette[best] - texel[i])) best = k;
+                }
+                bits |= (uint64_t)best << (3 * i);
+            }
+
+            uint8_t* block = dst + ((size_t)by * blocks + bx) * 8;
+            block[0] = (uint8_t)hi;
+            block[1] = (uint8_t)lo;
+            for (int b = 0; b < 6; ++b)
+                block[2 + b] = (uint8_t)(bits >> (8 * b));
+        }
+    }
+}
+
+void decodeBC4Slice(const uint8_t* src, int size, float* dst) {
+    int blocks = (size + 3) / 4;
+    for (int by = 0; by < blocks; ++by) {
+        for (int bx = 0; bx < blocks; ++bx) {
+            const uint8_t* block = src + ((size_t)by * blocks + bx) * 8;
+            float r0 = block[0] / 255.0f, r1 = block[1] / 255.0f;
+            float palette[8] = { r0, r1 };
+            for (int k = 1; k <= 6; ++k)
+                palette[k + 1] = r0 > r1 ? ((7 - k) * r0 + k * r1) / 7.0f
+                                         : (k <= 4 ? ((5 - k) * r0 + k * r1) / 5.0f : (k == 5 ? 0.0f : 1.0f));
+            uint64_t bits = 0;
+            for (int b = 0; b < 6; ++b)
+                bits |= (uint64_t)block[2 + b] << (8 * b);
+            for (int i = 0; i < 16; ++i) {
+                int x = bx * 4 + (i & 3), y = by * 4 + (i >> 2);
+                if (x < size && y < size)
+                    dst[(size_t)y * size + x] = palette[(bits >> (3 * i)) & 7];
+            }
+        }
+    }
+}
+
+/**
+ * @brief Переводит float-срез в байты выбранного формата.
+ */
+void encodeNoiseSlice(const float* src, int size, NoiseFormat format, uint8_t* dst) {
+    size_t texels = (size_t)size * size;
+    switch (format) {
+    case NoiseFormat::R32F:
+        memcpy(dst, src, texels * sizeof(float));
+        break;
+    case NoiseFormat::R16F:
+        for (size_t i = 0; i < texels; ++i) {
+            uint16_t h = floatToHalf(src[i]);
+            memcpy(dst + i * 2, &h, 2);
+        }
+        break;
+    case NoiseFormat::R8:
+        for (size_t i = 0; i < texels; ++i)
+            dst[i] = (uint8_t)std::lround(std::min(std::max(src[i], 0.0f), 1.0f) * 255.0f);
+        break;
+    case NoiseFormat::BC4:
+        encodeBC4Slice(src, size, dst);
+        break;
+    }
+}
+
+void decodeNoiseSlice(const uint8_t* src, int size, NoiseFormat format, float* dst) {
+    size_t texels = (size_t)size * size;
+    switch (format) {
+    case NoiseFormat::R32F:
+        memcpy(dst, src, texels * sizeof(float));
+        break;
+    case NoiseFormat::R16F:
+        for (size_t i = 0; i < texels; ++i) {
+            uint16_t h;
+            memcpy(&h, src + i * 2, 2);
+            dst[i] = halfToFloat(h);
+        }
+        break;
+    case NoiseFormat::R8:
+        for (size_t i = 0; i < texels; ++i)
+            dst[i] = src[i] / 255.0f;
+        break;
+    case NoiseFormat::BC4:
+        decodeBC4Slice(src, size, dst);
+        break;
+    }
+}
+
+/**
+ * @brief Печатает отчёт о потерях каждого формата относительно float-эталона.
+ *
+ * Для каждого формата: объём в видеопамяти, максимальная и среднеквадратичная
+ * ошибка и PSNR. Помогает выбрать самый дешёвый формат без видимых артефактов.
+ */
+void printNoiseFormatReport(const std::vector<float>& reference, int size) {
+    std::cout << "Noise format report (" << size << "^3, against r32f):\n"
+              << "  format      VRAM    max error       RMSE    PSNR dB\n";
+    size_t sliceTexels = (size_t)size * size;
+    for (const NoiseFormatDesc& desc : noiseFormats) {
+        std::vector<double> sliceMax(size), sliceSq(size);
+        parallelFor(size, [&](int z) {
+            const float* ref = reference.data() + z * sliceTexels;
+            std::vector<uint8_t> encoded(noiseSliceBytes(size, desc.format));
+            std::vector<float> decoded(sliceTexels);
+            encodeNoiseSlice(ref, size, desc.format, encoded.data());
+            decodeNoiseSlice(encoded.data(), size, desc.format, decoded.data());
+            for (size_t i = 0; i < sliceTexels; ++i) {
+                double e = std::fabs((double)decoded[i] - ref[i]);
+                sliceMax[z] = std::max(sliceMax[z], e);
+                sliceSq[z] += e * e;
+            }
+        });
+        double maxError = 0.0, sq = 0.0;
+        for (int z = 0; z < size; ++z) {
+            maxError = std::max(maxError, sliceMax[z]);
+            sq += sliceSq[z];
+        }
+        double rmse = std::sqrt(sq / ((double)sliceTexels * size));
+        double mb = noiseSliceBytes(size, desc.format) * (double)size / (1024.0 * 1024.0);
+        char line[128];
+        snprintf(line, sizeof(line), "  %-6s %7.1f MB %12.6f %10.6f %10s\n", desc.name, mb, maxError, rmse,
+                 rmse > 0.0 ? std::to_string((int)std::lround(20.0 * std::log10(1.0 / rmse))).c_str() : "inf");
+        std::cout << line;
+    }
+    std::cout.flush();
+}
+
+/**
+ * @brief Параметры объёма шума.
+ *
+ * В тайлящемся режиме период решётки Перлина округляется до целого числа
+ * ячеек на размер текстуры, поэтому объём бесшовно повторяется с GL_REPEAT.
+ * Частота при этом слегка корректируется (0.04 → 10/256 для 256³).
+ */
+struct NoiseSettings {
+    int size = 256;             // ↑ resolution, ↓ frequency for smoother fbm
+    float frequency = 0.04f;
+    NoiseFormat format = NoiseFormat::R32F;
+    bool tiling = true;
+    unsigned seed = 237;
+
+    /// Период решётки в ячейках (256 — классический, не тайлящийся шум).
+    int period() const {
+        return tiling ? std::min(std::max((int)std::lround(size * frequency), 1), 256) : 256;
+    }
+
+    /// Частота, с которой фактически запекается объём.
+    float bakeFrequency() const { return tiling ? (float)period() / size : frequency; }
+};
+
+/**
+ * @brief Уменьшает тайлящийся объём вдвое по каждой оси (бокс-фильтр 2x2x2).
+ *
+ * Нужен для mip-цепочки сжатых форматов, для которых glGenerateMipmap недоступен.
+ */
+std::vector<float> downsampleNoiseVolume(const std::vector<float>& src, int size) {
+    int half = std::max(size / 2, 1);
+    std::vector<float> dst((size_t)half * half * half);
+    auto at = [&](int x, int y, int z) {
+        return src[((size_t)(z % size) * size + (y % size)) * size + (x % size)];
+    };
+    parallelFor(half, [&](int z) {
+        for (int y = 0; y < half; ++y) {
+            for (int x = 0; x < half; ++x) {
+                float sum = 0.0f;
+                for (int i = 0; i < 8; ++i)
+                    sum += at(2 * x + (i & 1), 2 * y + ((i >> 1) & 1), 2 * z + (i >> 2));
+                dst[((size_t)z * half + y) * half + x] = sum * 0.125f;
+            }
+        }
+    });
+    return dst;
+}
+
+/**
+ * @brief Загружает закодированный уровень объёма в текущую GL_TEXTURE_3D.
+ *
+ * @return false, если драйвер отверг формат (например, RGTC для 3D-текстур)
+ */
+bool uploadNoiseVolume(int size, NoiseFormat format, const uint8_t* data, int level = 0) {
+    const NoiseFormatDesc& desc = noiseFormatDesc(format);
+    while (glGetError() != GL_NO_ERROR) {}
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (format == NoiseFormat::BC4) {
+        GLsizei bytes = (GLsizei)(noiseSliceBytes(size, format) * size);
+        glCompressedTexImage3D(GL_TEXTURE_3D, level, desc.internalFormat, size, size, size, 0, bytes, data);
+    }
+    else {
+        glTexImage3D(GL_TEXTURE_3D, level, desc.internalFormat, size, size, size, 0, GL_RED, desc.type, data);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    return glGetError() == GL_NO_ERROR;
+}
+
+/**
+ * @brief Настраивает выборку из объёма шума в текущей GL_TEXTURE_3D.
+ *
+ * Тайлящийся объём читается с GL_REPEAT и трилинейно по mip-цепочке:
+ * высокие октавы FBM попадают в маленькие уровни, которые живут в кэше.
+ *
+ * @param generateMips — построить mip-цепочку на GPU (false, если уровни уже загружены)
+ */
+void setNoiseSampling(bool tiling, bool generateMips = true) {
+    GLenum wrap = tiling ? GL_REPEAT : GL_CLAMP_TO_EDGE;
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, wrap);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, wrap);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, wrap);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, tiling ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    if (tiling && generateMips)
+        glGenerateMipmap(GL_TEXTURE_3D);
+}
+
+/// Один mip-уровень закодированного объёма (данными не владеет).
+struct NoiseLevelView {
+    const uint8_t* data;
+    size_t bytes;
+};
+
+/**
+ * @brief Объём шума, закодированный в формат хранения, со всеми mip-уровнями.
+ *
+ * Для R32F нулевой уровень ссылается прямо на исходный float-буфер,
+ * поэтому он должен жить, пока используется volume.
+ */
+struct EncodedNoiseVolume {
+    NoiseFormat format = NoiseFormat::R32F;
+    int size = 0;
+    std::vector<NoiseLevelView> levels;
+    std::vector<std::vector<uint8_t>> storage;
+};
+
+/**
+ * @brief Квантует float-объём в format; для тайлящегося BC4 строит и mip-уровни.
+ */
+EncodedNoiseVolume encodeNoiseVolume(const std::vector<float>& data, const NoiseSettings& settings, NoiseFormat format) {
+    EncodedNoiseVolume volume;
+    volume.format = format;
+    volume.size = settings.size;
+
+    // R32F uploads straight from the float buffer, other formats are packed slice by slice
+    if (format == NoiseFormat::R32F) {
+        volume.levels.push_back({ (const uint8_t*)data.data(), data.size() * sizeof(float) });
+        return volume;
+    }
+
+    const std::vector<float>* level = &data;
+    std::vector<float> downsampled;
+    // Compressed levels cannot be generated by the driver, so BC4 mips are encoded here
+    int lastMip = settings.tiling && format == NoiseFormat::BC4 ? 1 << 30 : 0;
+    for (int mip = 0, mipSize = settings.size; mip <= lastMip && mipSize >= 1; ++mip, mipSize /= 2) {
+        if (mip > 0) {
+            downsampled = downsampleNoiseVolume(*level, mipSize * 2);
+            level = &downsampled;
+        }
+        size_t sliceBytes = noiseSliceBytes(mipSize, format);
+        volume.storage.emplace_back(sliceBytes * mipSize);
+        uint8_t* dst = volume.storage.back().data();
+        parallelFor(mipSize, [&](int z) {
+            encodeNoiseSlice(level->data() + (size_t)z * mipSize * mipSize, mipSize, format, dst + z * sliceBytes);
+        });
+        volume.levels.push_back({ dst, sliceBytes * mipSize });
+    }
+    return volume;
+}
+
+/**
+ * @brief Загружает все уровни в текущую GL_TEXTURE_3D.
+ *
+ * @return false, если драйвер отверг формат
+ */
+bool uploadNoiseLevels(int size, NoiseFormat format, const std::vector<NoiseLevelView>& levels) {
+    for (int mip = 0; mip < (int)levels.size(); ++mip) {
+        if (!uploadNoiseVolume(std::max(size >> mip, 1), format, levels[mip].data, mip))
+            return false;
+    }
+    return true;
+}
+
+void logNoiseTexture(const NoiseSettings& settings, NoiseFormat format) {
+    std::cout << "Noise texture: " << noiseFormatDesc(format).name << ", "
+              << noiseSliceBytes(settings.size, format) * settings.size / (1024 * 1024) << " MB"
+              << (settings.tiling ? ", tiling period " + std::to_string(settings.period()) + " + mips" : "")
+              << std::endl;
+}
+
+// ---------- Noise Cache ----------
+// Запечённый объём кэшируется на диске. Файл: заголовок на одной странице,
+// затем уровни, каждый с границы страницы. При старте файл отображается
+// в память и загружается в текстуру прямо из отображения.
+
+// Увеличивать при любом изменении PerlinNoise3D или запекания
+const uint32_t noiseGeneratorVersion = 1;
+const size_t noiseCachePageSize = 4096;
+const int noiseCacheMaxLevels = 16;
+
+struct NoiseCacheHeader {
+    char magic[8];
+    // Key: every field that influences the baked texels
+    uint32_t generatorVersion;
+    uint32_t seed;
+    int32_t size;
+    float frequency;
+    int32_t period;
+    int32_t format;
+    int32_t tiling;
+    // Payload
+    int32_t storedFormat;   // may differ from format after a driver fallback (bc4 → r8)
+    int32_t levelCount;
+    uint64_t levelOffset[noiseCacheMaxLevels];
+    uint64_t levelBytes[noiseCacheMaxLevels];
+};
+
+NoiseCacheHeader makeNoiseCacheHeader(const NoiseSettings& settings) {
+    NoiseCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "FIRENOIS", 8);
+    header.generatorVersion = noiseGeneratorVersion;
+    header.seed = settings.seed;
+    header.size = settings.size;
+    header.frequency = settings.bakeFrequency();
+    header.period = settings.period();
+    header.format = (int32_t)settings.format;
+    header.tiling = settings.tiling ? 1 : 0;
+    return header;
+}
+
+/// FNV-1a — короткий стабильный хэш для имён файлов кэша.
+uint64_t fnv1a(const void* data, size_t bytes, uint64_t hash = 1469598103934665603ull) {
+    const uint8_t* p = (const uint8_t*)data;
+    for (size_t i = 0; i < bytes; ++i) {
+        hash ^= p[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+std::string noiseCachePath(const std::string& dir, const NoiseSettings& settings) {
+    NoiseCacheHeader key = makeNoiseCacheHeader(settings);
+    std::ostringstream name;
+    name << "noise-" << settings.size << "-" << noiseFormatDesc(settings.format).name << "-"
+         << std::hex << std::setw(16) << std::setfill('0')
+         << fnv1a(&key, offsetof(NoiseCacheHeader, storedFormat)) << ".bin";
+    return (std::filesystem::path(dir) / name.str()).string();
+}
+
+/**
+ * @brief Файл, отображённый в память только для чтения (mmap / MapViewOfFile).
+ */
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) return;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) return;
+        ptr = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (ptr) length = (size_t)fileSize.QuadPart;
+#else
+        fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) return;
+        void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) return;
+        ptr = (const uint8_t*)p;
+        length = (size_t)st.st_size;
+        madvise(p, length, MADV_SEQUENTIAL);
+#endif
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (ptr) UnmapViewOfFile(ptr);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if (ptr) munmap((void*)ptr, length);
+        if (fd >= 0) close(fd);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* data() const { return ptr; }
+    size_t size() const { return length; }
+
+private:
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+    const uint8_t* ptr = nullptr;
+    size_t length = 0;
+};
+
+/**
+ * @brief Пишет файл атомарно: во временный файл рядом, затем rename.
+ *
+ * Параллельно запущенные процессы никогда не увидят недописанный файл.
+ * Каталог создаётся при необходимости.
+ */
+template <typename WriteFn>
+bool writeFileAtomic(const std::string& path, WriteFn&& write) {
+    std::error_code ec;
+    std::filesystem::path target(path);
+    std::filesystem::create_directories(target.parent_path(), ec);
+    std::filesystem::path temp = target;
+    temp += ".tmp" + std::to_string(std::random_device{}());
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        write(out);
+        if (!out.good()) {
+            out.close();
+            std::filesystem::remove(temp, ec);
+            return false;
+        }
+    }
+    std::filesystem::rename(temp, target, ec);
+    if (ec) {
+        std::filesystem::remove(temp, ec);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Записывает объём в кэш (заголовок и уровни с границ страниц).
+ */
+bool writeNoiseCache(const std::string& path, const NoiseSettings& settings, const EncodedNoiseVolume& volume) {
+    if ((int)volume.levels.size() > noiseCacheMaxLevels) return false;
+    NoiseCacheHeader header = makeNoiseCacheHeader(settings);
+    header.storedFormat = (int32_t)volume.format;
+    header.levelCount = (int32_t)volume.levels.size();
+    uint64_t offset = noiseCachePageSize;
+    for (int i = 0; i < header.levelCount; ++i) {
+        header.levelOffset[i] = offset;
+        header.levelBytes[i] = volume.levels[i].bytes;
+        offset += (volume.levels[i].bytes + noiseCachePageSize - 1) / noiseCachePageSize * noiseCachePageSize;
+    }
+
+    bool written = writeFileAtomic(path, [&](std::ostream& out) {
+        std::vector<char> padding(noiseCachePageSize, 0);
+        out.write((const char*)&header, sizeof(header));
+        out.write(padding.data(), noiseCachePageSize - sizeof(header));
+        for (int i = 0; i < header.levelCount; ++i) {
+            out.write((const char*)volume.levels[i].data, (std::streamsize)volume.levels[i].bytes);
+            size_t tail = (size_t)(header.levelBytes[i] % noiseCachePageSize);
+            if (tail) out.write(padding.data(), noiseCachePageSize - tail);
+        }
+    });
+    if (!written) {
+        std::cerr << "Noise cache: failed to write " << path << std::endl;
+        return false;
+    }
+    std::cout << "Noise cache: wrote " << path << std::endl;
+    return true;
+}
+
+/**
+ * @brief Пытается загрузить объём из кэша, не копируя его в память процесса.
+ *
+ * @return GLuint — ID текстуры или 0 при промахе (нет файла, другой ключ, повреждён)
+ */
+GLuint loadNoiseTextureFromCache(const std::string& dir, const NoiseSettings& settings) {
+    double start = glfwGetTime();
+    std::string path = noiseCachePath(dir, settings);
+    MappedFile file(path);
+    if (!file.data() || file.size() < noiseCachePageSize) return 0;
+
+    NoiseCacheHeader expected = makeNoiseCacheHeader(settings);
+    NoiseCacheHeader header;
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(&header, &expected, offsetof(NoiseCacheHeader, storedFormat)) != 0 ||
+        header.storedFormat < 0 || header.storedFormat > (int32_t)NoiseFormat::BC4 ||
+        header.levelCount < 1 || header.levelCount > noiseCacheMaxLevels) {
+        std::cerr << "Noise cache: ignoring stale or foreign file " << path << std::endl;
+        return 0;
+    }
+
+    NoiseFormat format = (NoiseFormat)header.storedFormat;
+    std::vector<NoiseLevelView> levels;
+    for (int i = 0; i < header.levelCount; ++i) {
+        int mipSize = std::max(settings.size >> i, 1);
+        if (header.levelBytes[i] != noiseSliceBytes(mipSize, format) * mipSize ||
+            header.levelOffset[i] + header.levelBytes[i] > file.size()) {
+            std::cerr << "Noise cache: truncated file " << path << std::endl;
+            return 0;
+        }
+        levels.push_back({ file.data() + header.levelOffset[i], (size_t)header.levelBytes[i] });
+    }
+
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glState.bindTexture(GL_TEXTURE_3D, tex);
+    if (!uploadNoiseLevels(settings.size, format, levels)) {
+        glState.deleteTextures(1, &tex);
+        return 0;
+    }
+    setNoiseSampling(settings.tiling, levels.size() == 1);
+    std::cout << "Noise cache: hit " << path << ", "
+              << int((glfwGetTime() - start) * 1000.0) << " ms" << std::endl;
+    logNoiseTexture(settings, format);
+    return tex;
+}
+
+/**
+ * @brief Создаёт 3D-текстуру на основе шума Перлина.
+ *
+ * Текстура заполняется значениями шума в диапазоне [0, 1],
+ * нормализованными из [-1, 1]. Используется в шейдере как `sampler3D`.
+ * Z-срезы запекаются параллельно на всех ядрах и квантуются в settings.format.
+ *
+ * @param settings — размер, частота, формат и режим тайлинга
+ * @param report — напечатать сравнение всех форматов с float-эталоном
+ * @param cacheDir — куда сохранить результат для следующих запусков ("" — не сохранять)
+ * @return GLuint — ID созданной OpenGL-текстуры
+ */
+GLuint create3DNoiseTexture(const NoiseSettings& settings, bool report = false, const std::string& cacheDir = "") {
+    int size = settings.size;
+    float frequency = settings.bakeFrequency();
+    std::vector<float> data((size_t)size * size * size);
+    PerlinNoise3D perlin(settings.seed, settings.period());
+
+    double start = glfwGetTime();
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    bakeNoiseVolume(perlin, size, frequency, data.data(), threads);
+    std::cout << "Noise bake: " << size << "^3, " << threads << " threads, "
+              << PerlinNoise3D::simdName() << ", "
+              << int((glfwGetTime() - start) * 1000.0) << " ms" << std::endl;
+    if (report)
+        printNoiseFormatReport(data, size);
+
+    EncodedNoiseVolume volume = encodeNoiseVolume(data, settings, settings.format);
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glState.bindTexture(GL_TEXTURE_3D, tex);
+    if (!uploadNoiseLevels(size, volume.format, volume.levels)) {
+        std::cerr << "Noise format " << noiseFormatDesc(volume.format).name
+                  << " is not supported for 3D textures by this driver, falling back to r8" << std::endl;
+        volume = encodeNoiseVolume(data, settings, NoiseFormat::R8);
+        uploadNoiseLevels(size, volume.format, volume.levels);
+    }
+    setNoiseSampling(settings.tiling, volume.levels.size() == 1);
+    logNoiseTexture(settings, volume.format);
+
+    if (!cacheDir.empty())
+        writeNoiseCache(noiseCachePath(cacheDir, settings), settings, volume);
+    return tex;
+}
+
+// ---------- Streamed Noise Upload ----------
+
+/**
+ * @brief Фоновое запекание объёма с постепенной загрузкой готовых срезов.
+ *
+ * Пока рабочие потоки считают срезы, главный поток каждый кадр переливает
+ * готовые в текстуру через PBO (с orphaning, работает на GL 3.3), укладываясь
+ * в бюджет времени. Когда загружены все срезы, строится mip-цепочка,
+ * объём пишется в кэш и текстура отдаётся через release().
+ */
+class NoiseStreamer {
+public:
+    /// Время кадра, отдаваемое загрузке срезов.
+    static constexpr double frameBudgetMs = 2.0;
+
+    NoiseStreamer(const NoiseSettings& settings, const std::string& cacheDir)
+        : settings(settings), cacheDir(cacheDir), sliceBytes(noiseSliceBytes(settings.size, settings.format)),
+          data((size_t)settings.size * settings.size * settings.size), ready(settings.size) {
+        int size = settings.size;
+        if (settings.format != NoiseFormat::R32F)
+            packed.resize(sliceBytes * size);
+
+        glGenTextures(1, &tex);
+        glState.bindTexture(GL_TEXTURE_3D, tex);
+        uploadNoiseVolume(size, settings.format, nullptr);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glGenBuffers(1, &pbo);
+
+        start = glfwGetTime();
+        // Leave a core to the render thread so the placeholder keeps animating
+        threads = backgroundThreadCount();
+        baker = std::thread([this, size]() {
+            PerlinNoise3D perlin(this->settings.seed, this->settings.period());
+            float frequency = this->settings.bakeFrequency();
+            parallelFor(size, [&](int z) {
+                if (cancel) return;
+                float* slice = data.data() + (size_t)z * size * size;
+                bakeNoiseSlice(perlin, size, frequency, z, slice);
+                if (!packed.empty())
+                    encodeNoiseSlice(slice, size, this->settings.format, packed.data() + z * sliceBytes);
+                ready[z] = true;
+            }, threads);
+        });
+    }
+
+    ~NoiseStreamer() {
+        cancel = true;
+        if (baker.joinable()) baker.join();
+        if (pbo) glDeleteBuffers(1, &pbo);
+        if (tex) glState.deleteTextures(1, &tex);
+    }
+
+    NoiseStreamer(const NoiseStreamer&) = delete;
+    NoiseStreamer& operator=(const NoiseStreamer&) = delete;
+
+    /**
+     * @brief Загружает готовые срезы, пока не исчерпан бюджет кадра.
+     *
+     * @param budgetMs — сколько миллисекунд кадра можно потратить на загрузку
+     * @return true, когда объём полностью загружен и его можно забрать release()
+     */
+    bool update(double budgetMs) {
+        if (next == settings.size) return true;
+        const NoiseFormatDesc& desc = noiseFormatDesc(settings.format);
+        const uint8_t* src = packed.empty() ? (const uint8_t*)data.data() : packed.data();
+        int size = settings.size;
+        double frameStart = glfwGetTime();
+
+        glState.bindTexture(GL_TEXTURE_3D, tex);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        // Slices finish roughly in z order; upload the ready prefix
+        while (next < size && ready[next] && (glfwGetTime() - frameStart) * 1000.0 < budgetMs) {
+            // Orphan the buffer so mapping never waits for the previous transfer
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, sliceBytes, nullptr, GL_STREAM_DRAW);
+            void* dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, sliceBytes,
+                                         GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            if (dst) {
+                memcpy(dst, src + next * sliceBytes, sliceBytes);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, next, size, size, 1, GL_RED, desc.type, nullptr);
+            }
+            ++next;
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        ++frames;
+
+        if (next < size) return false;
+        baker.join();
+        std::cout << "Noise bake: " << size << "^3, " << threads << " threads, "
+                  << PerlinNoise3D::simdName() << ", streamed in " << frames << " frames, "
+                  << int((glfwGetTime() - start) * 1000.0) << " ms" << std::endl;
+        setNoiseSampling(settings.tiling);
+        logNoiseTexture(settings, settings.format);
+        if (!cacheDir.empty()) {
+            EncodedNoiseVolume volume;
+            volume.format = settings.format;
+            volume.size = size;
+            volume.levels.push_back({ src, sliceBytes * size });
+            writeNoiseCache(noiseCachePath(cacheDir, settings), settings, volume);
+        }
+        return true;
+    }
+
+    /// Отдаёт готовую текстуру; после этого streamer ей не владеет.
+    GLuint release() {
+        GLuint result = tex;
+        tex = 0;
+        return result;
+    }
+
+private:
+    NoiseSettings settings;
+    std::string cacheDir;
+    size_t sliceBytes;
+    std::vector<float> data;
+    std::vector<uint8_t> packed;        // encoded slices for formats other than r32f
+    std::vector<std::atomic<bool>> ready;
+    std::atomic<bool> cancel{ false };
+    std::thread baker;
+    unsigned threads = 1;
+    GLuint tex = 0;
+    GLuint pbo = 0;
+    int next = 0;                       // first slice not yet uploaded
+    int frames = 0;
+    double start = 0.0;
+};
+
+/**
+ * @brief Грубый объём 32³ с той же решёткой — показывается, пока идёт запекание.
+ */
+GLuint createPlaceholderNoiseTexture(const NoiseSettings& settings) {
+    NoiseSettings placeholder = settings;
+    placeholder.size = 32;
+    placeholder.format = NoiseFormat::R8;
+    // Same lattice period, so the coarse volume tiles and lines up with the full one
+    placeholder.frequency = settings.frequency * settings.size / placeholder.size;
+    return create3DNoiseTexture(placeholder);
+}
+
+// ---------- Animated 4D Noise ----------
+/**
+ * @brief Кольцо тонких объёмов 4D-шума, идущих друг за другом по времени.
+ *
+ * Вместо прокрутки статического объёма 256³ по z фоновый поток непрерывно
+ * запекает срезы noise(x, y, z, w) размером 128×128×16 для следующих моментов w,
+ * а update() загружает готовые в кольцо текстур и привязывает пару срезов вокруг
+ * текущего времени — шейдер смешивает их (NOISE_4D). Кольцо занимает 4 × 0.5 МБ
+ * и не повторяется, сколько бы ни шла анимация.
+ */
+class NoiseTimeRing {
+public:
+    static const int ringSize = 4;
+    static const int width = 128;           // x / y, same lattice period as the static volume
+    static const int depth = 16;            // z holds independent layers, not time
+    static const int zPeriod = 2;           // lattice cells along z
+    static constexpr double slicesPerSecond = 4.0;   // of fire time; w moves one cell per second
+
+    explicit NoiseTimeRing(const NoiseSettings& settings)
+        : perlin(settings.seed, settings.period()) {
+        glGenTextures(ringSize, textures);
+        for (GLuint texture : textures) {
+            glState.bindTexture(GL_TEXTURE_3D, texture);
+            glTexImage3D(GL_TEXTURE_3D, 0, GL_R16F, width, width, depth, 0, GL_RED, GL_FLOAT, nullptr);
+            setNoiseSampling(true, false);
+        }
+        std::fill(std::begin(slotIndex), std::end(slotIndex), -1LL);
+        baker = std::thread([this] { bakeLoop(); });
+        std::cout << "Noise: 4D time slices " << width << "x" << width << "x" << depth << " r16f, ring of "
+                  << ringSize << ", " << slicesPerSecond << " slices/s" << std::endl;
+    }
+
+    ~NoiseTimeRing() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_all();
+        baker.join();
+        glState.deleteTextures(ringSize, textures);
+    }
+
+    NoiseTimeRing(const NoiseTimeRing&) = delete;
+    NoiseTimeRing& operator=(const NoiseTimeRing&) = delete;
+
+    /**
+     * @brief Загружает готовые срезы и привязывает пару вокруг fireTime к юнитам 0 и 5.
+     *
+     * Пока нужный срез не запечён (скачок времени), показывается ближайшая
+     * готовая пара. При wait — ждёт нужные срезы (для бенчмарка).
+     * @return вес второго среза для uniform noiseBlend
+     */
+    float update(double fireTime, bool wait = false) {
+        double position = fireTime * slicesPerSecond;
+        long long first = (long long)std::floor(position);
+        float blend = (float)(position - first);
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (first != wanted) {
+                wanted = first;
+                wake.notify_all();
+            }
+            // The very first pair is always waited for: there is nothing to show yet
+            bool block = wait || !hasPair;
+            while (true) {
+                for (auto& slice : finished)
+                    upload(slice.first, slice.second);
+                finished.clear();
+                if (!block || (loaded(first) && loaded(first + 1))) break;
+                done.wait(lock);
+            }
+        }
+        if (loaded(first) && loaded(first + 1)) {
+            current = first;
+            hasPair = true;
+        }
+        else
+            blend = first > current ? 1.0f : 0.0f;
+
+        glState.activeTexture(GL_TEXTURE5);
+        glState.bindTexture(GL_TEXTURE_3D, textures[slot(current + 1)]);
+        glState.activeTexture(GL_TEXTURE0);
+        glState.bindTexture(GL_TEXTURE_3D, textures[slot(current)]);
+        return blend;
+    }
+
+private:
+    static int slot(long long index) { return (int)(((index % ringSize) + ringSize) % ringSize); }
+    bool loaded(long long index) const { return slotIndex[slot(index)] == index; }
+
+    // Called with the mutex held
+    void upload(long long index, const std::vector<float>& data) {
+        // Slices left behind by a time jump are dropped and baked again if needed
+        if (index < wanted || index >= wanted + ringSize) {
+            baked.erase(index);
+            return;
+        }
+        glState.bindTexture(GL_TEXTURE_3D, textures[slot(index)]);
+        glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, width, width, depth, GL_RED, GL_FLOAT, data.data());
+        glGenerateMipmap(GL_TEXTURE_3D);
+        slotIndex[slot(index)] = index;
+    }
+
+    void bakeLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stop) {
+            long long window = wanted, index = window;
+            baked.erase(baked.begin(), baked.lower_bound(window));
+            baked.erase(baked.lower_bound(window + ringSize), baked.end());
+            while (index < window + ringSize && baked.count(index)) ++index;
+            if (index == window + ringSize) {
+                wake.wait(lock);
+                continue;
+            }
+            lock.unlock();
+            std::vector<float> data = bakeSlice(index);
+            lock.lock();
+            finished.emplace_back(index, std::move(data));
+            baked.insert(index);
+            done.notify_all();
+        }
+    }
+
+    std::vector<float> bakeSlice(long long index) const {
+        std::vector<float> data((size_t)width * width * depth);
+        float xyStep = (float)perlin.latticePeriod() / width;
+        float zStep = (float)zPeriod / depth;
+        float w = (float)(index / slicesPerSecond);
+        unsigned threads = backgroundThreadCount();
+        parallelFor(depth, [&](int z) {
+            float* out = data.data() + (size_t)z * width * width;
+            for (int y = 0; y < width; ++y)
+                for (int x = 0; x < width; ++x)
+                    out[y * width + x] = 0.5f + 0.5f * perlin.noise(x * xyStep, y * xyStep, z * zStep, w, zPeriod);
+        }, threads);
+        return data;
+    }
+
+    PerlinNoise3D perlin;
+    GLuint textures[ringSize];
+    long long slotIndex[ringSize];
+    long long current = 0;                  // first slice of the bound pair
+    bool hasPair = false;
+
+    std::thread baker;
+    std::mutex mutex;
+    std::condition_variable wake;           // baker: the window moved or stop
+    std::condition_variable done;           // main thread: a slice is finished
+    long long wanted = 0;                   // first slice of the window to keep baked
+    std::deque<std::pair<long long, std::vector<float>>> finished;
+    std::set<long long> baked;              // slices of the window handed over to the main thread
+    bool stop = false;
+};
+
+// ---------- Shaders ----------
+// Every fire is an instance of the quad; per-instance data comes from FireEmitters
+const char* vertexShaderSrc = GLSL(
+    layout(location = 1) in vec4 emitterRect;     // centre.xy, half size.xy (NDC)
+    layout(location = 2) in vec4 emitterParams;   // seed offset, speed, colour scheme (-1 = COLOR_SCHEME)
+    out vec2 uv;
+    out float fireTime;
+    flat out int emitterScheme;
+    flat out float firePeriod;
+    // Per-frame values, written once per frame through UniformRing (FrameData in Project.cpp)
+    layout(std140) uniform FrameData {
+        vec2 uvOffset;      // sub-pixel jitter of the reduced-resolution pass
+        vec2 tileSize;      // TILE_CLASS != 0: tile extent in the emitter's [-1, 1] quad space
+        float time;
+        float noiseBlend;   // NOISE_4D: position between the two slices
+        float loopLength;   // LOOP: length of one cycle of time
+    };
+    uniform usampler2D tileClasses;     // TILE_CLASS != 0: one instance per tile of the emitter
+    // The two triangles of the quad come from gl_VertexID, so no vertex buffer is bound
+    const vec2 quadCorners[6] = vec2[6](vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(-1.0, 1.0),
+                                        vec2(1.0, -1.0), vec2(1.0, 1.0), vec2(-1.0, 1.0));
+    void main() {
+        vec2 pos = quadCorners[gl_VertexID];
+        vec2 corner = pos;
+        if (TILE_CLASS != 0) {
+            int columns = textureSize(tileClasses, 0).x;
+            ivec2 tile = ivec2(gl_InstanceID % columns, gl_InstanceID / columns);
+            // Tiles of the other classes collapse outside the clip volume
+            if (int(texelFetch(tileClasses, tile, 0).r) != TILE_CLASS) {
+                gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+                return;
+            }
+            corner = min(-1.0 + (vec2(tile) + pos * 0.5 + 0.5) * tileSize, vec2(1.0));
+        }
+        // The jitter is in fullscreen uv units; a smaller quad stretches its uv
+        uv = corner * 0.5 + 0.7 + uvOffset / emitterRect.zw + vec2(emitterParams.x, 0.0);
+        fireTime = time * emitterParams.y;
+        firePeriod = loopLength * emitterParams.y;
+        emitterScheme = int(emitterParams.z);
+        gl_Position = vec4(emitterRect.xy + corner * emitterRect.zw, 0.0, 1.0);
+    }
+);
+
+// --- Fragment shader: fire + smoke composition ---
+// Built-in copies of src/shader.vert and src/shader.frag, used when the files are
+// not found (see ShaderWatcher). Keep them in sync.
+// Feature toggles are #defines inserted by ShaderVariant::defines(), so disabled
+// features and untaken colour schemes are compiled out instead of branched on:
+//   COLOR_SCHEME (0 classic, 1 lava, 2 blue), FBM_OCTAVES, DISTORTION,
+//   FBM_VOLUME (1 reads the pre-summed octaves from fbmTex instead of looping over noiseTex),
+//   EMITTER_SCHEMES (1 lets each emitter pick its colour scheme, 0 always uses COLOR_SCHEME),
+//   TILE_CLASS (0 = whole emitter; 1 smoke-only, 2 calm fire, 3 full fire, see TileClassifier),
+//   NOISE_4D (1 crossfades the NoiseTimeRing slices instead of scrolling the volume along z),
+//   LOOP (1 rounds the scroll rates so the animation repeats every loopLength seconds),
+//   ANALYTIC_NOISE (lattice period of hashNoise() from analyticNoiseGLSL, 0 samples noiseTex)
+const char* fragmentShaderSrc = GLSL(
+    out vec4 FragColor;
+in vec2 uv;
+in float fireTime;
+flat in int emitterScheme;
+flat in float firePeriod;           // LOOP: fireTime of one cycle
+uniform sampler3D noiseTex;
+uniform sampler3D fbmTex;
+uniform sampler3D noiseTexNext;     // NOISE_4D: the time slice after noiseTex
+layout(std140) uniform FrameData {
+    vec2 uvOffset;
+    vec2 tileSize;
+    float time;
+    float noiseBlend;               // NOISE_4D: position between the two slices
+    float loopLength;
+};
+
+float noiseAt(vec3 p) {
+    if (ANALYTIC_NOISE != 0) return hashNoise(p);
+    if (NOISE_4D != 0) return mix(texture(noiseTex, p).r, texture(noiseTexNext, p).r, noiseBlend);
+    return texture(noiseTex, p).r;
+}
+
+// FBM with more octaves for detail
+float fbm(vec3 p) {
+    if (FBM_VOLUME != 0) return texture(fbmTex, p).r;
+    float v = 0.0;
+    float a = 0.5;
+    for (int i = 0; i < FBM_OCTAVES; i++) {
+        v += a * noiseAt(p);
+        p *= 2.0;
+        a *= 0.5;
+    }
+    return v;
+}
+
+// LOOP: rounds a scroll rate (per unit of t) so that one cycle moves the volume
+// by a whole number of periods; with GL_REPEAT the cycle ends where it began
+float loopRate(float rate) {
+    if (LOOP == 0) return rate;
+    float cycle = firePeriod * 0.2;
+    return sign(rate) * max(1.0, floor(abs(rate) * cycle + 0.5)) / cycle;
+}
+
+vec3 getFireColor(float fire) {
+    int scheme = (EMITTER_SCHEMES != 0 && emitterScheme >= 0) ? emitterScheme : COLOR_SCHEME;
+    if (scheme == 1) {
+        return mix(vec3(0.8, 0.1, 0.0), vec3(1.0, 0.4, 0.0), fire * 2.0);
+    }
+    else if (scheme == 2) {
+        return mix(vec3(0.0, 0.2, 0.8), vec3(0.2, 0.8, 1.0), fire * 2.0);
+    }
+    else {
+        return mix(vec3(1.0, 0.4, 0.0), vec3(1.0, 1.0, 0.2), fire * 2.0);
+    }
+}
+
+void main() {
+    float t = fireTime * 0.2;
+    // 4D noise evolves through its time slices, so z no longer scrolls
+    float zt = NOISE_4D != 0 ? 0.0 : t;
+    vec3 p = vec3(uv.x * 1.5, uv.y * 2.5 + t * loopRate(1.0), zt * loopRate(0.5));
+
+    float smoke = smoothstep(0.4, 0.9, fbm(p + vec3(0.0, 1.0, NOISE_4D != 0 ? 0.5 : -t * loopRate(0.2))));
+    vec3 colSmoke = mix(vec3(0.1), vec3(0.4), smoke);
+    vec3 finalColor = colSmoke;
+
+    // Smoke-only tiles (TILE_CLASS 1) lie where heightMask is 1
+    if (TILE_CLASS != 1) {
+        // The FBM volume keeps the distortion fields (fbm shifted by 0.5 in x / y)
+        // in G and B, so fire and distortion come from a single fetch.
+        // Calm tiles (TILE_CLASS 2) have too little fire to distort anything.
+        bool distort = DISTORTION != 0 && TILE_CLASS != 2;
+        vec3 fireNoise;
+        if (FBM_VOLUME != 0) {
+            fireNoise = texture(fbmTex, p).rgb;
+        }
+        else if (!distort) {
+            fireNoise = vec3(fbm(p), 0.5, 0.5);
+        }
+        else {
+            fireNoise = vec3(fbm(p), fbm(p + vec3(0.5, 0.0, zt * loopRate(0.3))), fbm(p + vec3(0.0, 0.5, zt * loopRate(0.3))));
+        }
+
+        float fire = pow(fireNoise.r, 3.0);
+        float heightMask = smoothstep(0.2, 1.0, uv.y);
+
+        // --- Heat Distortion ---
+        // Distort UV based on fire intensity and gradient
+        vec2 distortion = (fireNoise.gb - 0.5) * fire * 0.03; // scale distortion
+
+        vec2 distortedUV = uv + distortion;
+
+        // Recompute fire with distorted UV for consistency
+        float fireDistorted = fire;
+        if (distort) {
+            vec3 pDistorted = vec3(distortedUV.x * 1.5, distortedUV.y * 2.5 + t * loopRate(1.0), zt * loopRate(0.5));
+            fireDistorted = pow(fbm(pDistorted), 3.0);
+        }
+        vec3 colFire = getFireColor(fireDistorted);
+
+        // --- Smoke ---
+        finalColor = mix(colFire, colSmoke, heightMask);
+    }
+
+    FragColor = vec4(finalColor, 1.0);
+}
+);
+
+// ANALYTIC_NOISE: gradient noise computed in the shader instead of sampled from noiseTex.
+// Lattice, fade curve and the 12 edge gradients are those of PerlinNoise3D with
+// ANALYTIC_NOISE cells per unit of p, so it tiles like the volume; the corner
+// gradients come from an integer hash of the cell instead of the permutation table.
+// Inserted after the variant #defines of the fire programs and the spark update.
+const char* analyticNoiseGLSL = GLSL_CODE(
+uint latticeHash(ivec3 c) {
+    uint h = uint(c.x) * 0x8da6b343u ^ uint(c.y) * 0xd8163841u ^ uint(c.z) * 0xcb1ab31fu;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
+}
+
+float latticeGrad(ivec3 c, vec3 f) {
+    int h = int(latticeHash(c) & 15u);
+    float u = h < 8 ? f.x : f.y;
+    float v = h < 4 ? f.y : (h == 12 || h == 14 ? f.x : f.z);
+    return ((h & 1) != 0 ? -u : u) + ((h & 2) != 0 ? -v : v);
+}
+
+// Same range and tiling as texture(noiseTex, p).r: [0, 1], one period per unit of p
+float hashNoise(vec3 p) {
+    float period = float(max(ANALYTIC_NOISE, 1));
+    p *= period;
+    vec3 cell = floor(p);
+    vec3 f = p - cell;
+    ivec3 c0 = ivec3(mod(cell, period));
+    ivec3 c1 = ivec3(mod(cell + 1.0, period));
+    vec3 w = f * f * f * (f * (f * 6.0 - 15.0) + 10.0);
+    float n = mix(
+        mix(
+            mix(latticeGrad(c0, f), latticeGrad(ivec3(c1.x, c0.y, c0.z), f - vec3(1.0, 0.0, 0.0)), w.x),
+            mix(latticeGrad(ivec3(c0.x, c1.y, c0.z), f - vec3(0.0, 1.0, 0.0)),
+                latticeGrad(ivec3(c1.x, c1.y, c0.z), f - vec3(1.0, 1.0, 0.0)), w.x),
+            w.y),
+        mix(
+            mix(latticeGrad(ivec3(c0.x, c0.y, c1.z), f - vec3(0.0, 0.0, 1.0)),
+                latticeGrad(ivec3(c1.x, c0.y, c1.z), f - vec3(1.0, 0.0, 1.0)), w.x),
+            mix(latticeGrad(ivec3(c0.x, c1.y, c1.z), f - vec3(0.0, 1.0, 1.0)), latticeGrad(c1, f - 1.0), w.x),
+            w.y),
+        w.z);
+    return 0.5 + 0.5 * n;
+}
+);
+
+// ---------- Shader Setup ----------
+/// Полный журнал компилятора шейдера, без обрезки до фиксированного буфера.
+std::string shaderInfoLog(GLuint shader) {
+    GLint length = 0;
+    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+    std::string log(std::max(length, 1), '\0');
+    glGetShaderInfoLog(shader, (GLsizei)log.size(), nullptr, &log[0]);
+    log.resize(strlen(log.c_str()));
+    return log;
+}
+
+/// Полный журнал линковщика программы.
+std::string programInfoLog(GLuint program) {
+    GLint length = 0;
+    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+    std::string log(std::max(length, 1), '\0');
+    glGetProgramInfoLog(program, (GLsizei)log.size(), nullptr, &log[0]);
+    log.resize(strlen(log.c_str()));
+    return log;
+}
+
+GLuint compileShader(GLenum type, const char* src) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &src, nullptr);
+    glCompileShader(shader);
+    int success;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        std::cerr << "Shader error:\n" << shaderInfoLog(shader) << std::endl;
+    }
+    return shader;
+}
+
+/**
+ * @brief Вставляет строки #define сразу после строки #version.
+ *
+ * Исходник без #version получает "#version 330 core".
+ */
+std::string injectDefines(const std::string& source, const std::string& defines) {
+    size_t start = source.find_first_not_of(" \t\r\n");
+    if (start == std::string::npos || source.compare(start, 8, "#version") != 0)
+        return "#version 330 core\n" + defines + source;
+    size_t eol = source.find('\n', start);
+    if (eol == std::string::npos) return source + "\n" + defines;
+    return source.substr(0, eol + 1) + defines + source.substr(eol + 1);
+}
+
+/// Исходники программы огня: встроенные или прочитанные из src/shader.*.
+struct ShaderSources {
+    std::string vertex = vertexShaderSrc;
+    std::string fragment = fragmentShaderSrc;
+};
+
+/// Строка драйвера vendor|renderer|version — ключ всего, что зависит от GPU и драйвера.
+std::string glDriverString() {
+    return std::string((const char*)glGetString(GL_VENDOR)) + "|" + (const char*)glGetString(GL_RENDERER) + "|" +
+           (const char*)glGetString(GL_VERSION);
+}
+
+/**
+ * @brief Кэш слинкованных программ на диске (glGetProgramBinary / glProgramBinary).
+ *
+ * Ключ — хэш исходников (с #define варианта) и строк vendor/renderer/version
+ * драйвера: после обновления драйвера или правки шейдера файл просто
+ * не найдётся, а бинарник, отвергнутый драйвером, пересобирается из исходников.
+ */
+class ProgramBinaryCache {
+public:
+    ProgramBinaryCache(const std::string& dir, bool supported) : dir(supported ? dir : "") {
+        if (!this->dir.empty())
+            driver = glDriverString();
+    }
+
+    bool enabled() const { return !dir.empty(); }
+
+    /// Загружает программу из кэша; 0 — промах или бинарник не подошёл.
+    GLuint load(const std::string& vs, const std::string& fs) const {
+        if (!enabled()) return 0;
+        std::ifstream in(path(vs, fs), std::ios::binary);
+        Header header;
+        if (!in.read((char*)&header, sizeof(header)) || memcmp(header.magic, "FIREPROG", 8) != 0 ||
+            header.key != key(vs, fs) || header.length == 0)
+            return 0;
+        std::vector<char> binary(header.length);
+        if (!in.read(binary.data(), header.length)) return 0;
+
+        GLuint prog = glCreateProgram();
+        glProgramBinary(prog, header.format, binary.data(), (GLsizei)header.length);
+        int success = 0;
+        glGetProgramiv(prog, GL_LINK_STATUS, &success);
+        if (!success) {
+            glState.deleteProgram(prog);
+            return 0;
+        }
+        return prog;
+    }
+
+    /// Подготавливает программу к линковке, чтобы драйвер сохранил бинарник.
+    void prepare(GLuint prog) const {
+        if (enabled())
+            glProgramParameteri(prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    /// Сохраняет слинкованную программу.
+    void store(GLuint prog, const std::string& vs, const std::string& fs) const {
+        if (!enabled()) return;
+        GLint length = 0;
+        glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0) return;
+        std::vector<char> binary(length);
+        Header header;
+        memcpy(header.magic, "FIREPROG", 8);
+        header.key = key(vs, fs);
+        glGetProgramBinary(prog, length, nullptr, &header.format, binary.data());
+        header.length = (uint32_t)length;
+        writeFileAtomic(path(vs, fs), [&](std::ostream& out) {
+            out.write((const char*)&header, sizeof(header));
+            out.write(binary.data(), length);
+        });
+    }
+
+private:
+    struct Header {
+        char magic[8];
+        uint64_t key;
+        GLenum format;
+        uint32_t length;
+    };
+
+    uint64_t key(const std::string& vs, const std::string& fs) const {
+        uint64_t hash = fnv1a(driver.data(), driver.size());
+        hash = fnv1a(vs.data(), vs.size() + 1, hash);
+        return fnv1a(fs.data(), fs.size() + 1, hash);
+    }
+
+    std::string path(const std::string& vs, const std::string& fs) const {
+        std::ostringstream name;
+        name << "program-" << std::hex << std::setw(16) << std::setfill('0') << key(vs, fs) << ".bin";
+        return (std::filesystem::path(dir) / name.str()).string();
+    }
+
+    std::string dir;
+    std::string driver;
+};
+
+/// Назначает семплерам программы огня фиксированные текстурные юниты.
+void bindFireSamplers(GLuint prog) {
+    // Texture units are fixed: 0 = noise volume, 1 = FBM volume, 4 = tile classes,
+    // 5 = next 4D noise slice
+    glState.useProgram(prog);
+    glUniform1i(glGetUniformLocation(prog, "noiseTex"), 0);
+    glUniform1i(glGetUniformLocation(prog, "fbmTex"), 1);
+    glUniform1i(glGetUniformLocation(prog, "tileClasses"), 4);
+    glUniform1i(glGetUniformLocation(prog, "noiseTexNext"), 5);
+}
+
+/**
+ * @brief Компилирует и линкует вершинный и фрагментный шейдеры.
+ *
+ * Возвращает ID готовой шейдерной программы.
+ * Обработка ошибок компиляции осуществляется через stderr.
+ *
+ * @param sources — исходники вершинного и фрагментного шейдеров
+ * @param defines — строки #define варианта (см. ShaderVariant::defines)
+ * @param binaries — кэш бинарников программ (nullptr — всегда из исходников)
+ * @param fromBinary — сюда пишется, была ли программа загружена из кэша
+ * @return GLuint — ID шейдерной программы
+ */
+GLuint createShaderProgram(const ShaderSources& sources, const std::string& defines,
+                           const ProgramBinaryCache* binaries = nullptr, bool* fromBinary = nullptr) {
+    std::string vertex = injectDefines(sources.vertex, defines);
+    std::string fragment = injectDefines(sources.fragment, defines);
+    GLuint prog = binaries ? binaries->load(vertex, fragment) : 0;
+    if (fromBinary) *fromBinary = prog != 0;
+    if (!prog) {
+        GLuint vs = compileShader(GL_VERTEX_SHADER, vertex.c_str());
+        GLuint fs = compileShader(GL_FRAGMENT_SHADER, fragment.c_str());
+        prog = glCreateProgram();
+        if (binaries) binaries->prepare(prog);
+        glAttachShader(prog, vs);
+        glAttachShader(prog, fs);
+        glLinkProgram(prog);
+        glDeleteShader(vs);
+        glDeleteShader(fs);
+        int success = 0;
+        glGetProgramiv(prog, GL_LINK_STATUS, &success);
+        if (!success)
+            std::cerr << "Program link error:\n" << programInfoLog(prog) << std::endl;
+        else if (binaries)
+            binaries->store(prog, vertex, fragment);
+    }
+    bindFireSamplers(prog);
+    return prog;
+}
+
+// ---------- Shader Variants ----------
+
+/**
+ * @brief Набор compile-time переключателей фрагментного шейдера огня.
+ */
+struct ShaderVariant {
+    int colorScheme = 0;        // 0 = classic fire, 1 = lava, 2 = blue flame
+    int octaves = 6;
+    bool sparks = true;             // SparkParticles on top; not a shader define, so not in key()
+    bool distortion = true;
+    bool fbmVolume = false;
+    bool emitterSchemes = false;    // colour scheme comes from each emitter (see FireEmitter::colorScheme)
+    int tileClass = 0;              // 0 = whole emitter, 1..3 = one TileClassifier class
+    bool noise4d = false;           // sample the NoiseTimeRing pair
+    bool loop = false;              // periodic animation, see the loopLength uniform
+    int analyticNoise = 0;          // lattice period of the in-shader noise, 0 = sample noiseTex
+
+    /// Облегчённый вариант для слабых GPU: 4 октавы, без искр и искажений.
+    static ShaderVariant lite() {
+        ShaderVariant variant;
+        variant.octaves = 4;
+        variant.sparks = false;
+        variant.distortion = false;
+        return variant;
+    }
+
+    std::string defines() const {
+        std::ostringstream out;
+        out << "#define COLOR_SCHEME " << colorScheme << "\n"
+            << "#define FBM_OCTAVES " << octaves << "\n"
+            << "#define DISTORTION " << (distortion ? 1 : 0) << "\n"
+            << "#define FBM_VOLUME " << (fbmVolume ? 1 : 0) << "\n"
+            << "#define EMITTER_SCHEMES " << (emitterSchemes ? 1 : 0) << "\n"
+            << "#define TILE_CLASS " << tileClass << "\n"
+            << "#define NOISE_4D " << (noise4d ? 1 : 0) << "\n"
+            << "#define LOOP " << (loop ? 1 : 0) << "\n"
+            << "#define ANALYTIC_NOISE " << analyticNoise << "\n";
+        return out.str();
+    }
+
+    /// Вставка после #version в исходники огня: #define варианта и hashNoise().
+    std::string header() const { return defines() + analyticNoiseGLSL; }
+
+    /// Уникальный ключ варианта для кэша программ.
+    uint32_t key() const {
+        return (uint32_t)colorScheme | (uint32_t)octaves << 4 |
+               (uint32_t)distortion << 9 | (uint32_t)fbmVolume << 11 |
+               (uint32_t)emitterSchemes << 12 | (uint32_t)tileClass << 13 |
+               (uint32_t)noise4d << 15 | (uint32_t)loop << 16 | (uint32_t)analyticNoise << 17;
+    }
+
+    /// Краткое имя для логов и результатов бенчмарка.
+    std::string name() const {
+        static const char* schemes[] = { "classic", "lava", "blue" };
+        std::string result = std::string(schemes[colorScheme]) + "/" + std::to_string(octaves) + "oct";
+        if (!distortion) result += "/no-distortion";
+        if (fbmVolume) result += "/fbm-volume";
+        if (emitterSchemes) result += "/per-emitter";
+        static const char* tileClasses[] = { "", "/tiles-smoke", "/tiles-calm", "/tiles-fire" };
+        result += tileClasses[tileClass];
+        if (noise4d) result += "/4d";
+        if (loop) result += "/loop";
+        if (analyticNoise) result += "/analytic";
+        return result;
+    }
+};
+
+/**
+ * @brief Uniform-блок FrameData шейдеров огня (std140).
+ *
+ * Одинаков для всех вариантов и классов тайлов, поэтому пишется один раз за
+ * drawFires(), а не glUniform* на каждую программу.
+ */
+struct FrameData {
+    float uvOffset[2];
+    float tileSize[2];
+    float time;
+    float noiseBlend;
+    float loopLength;
+    float pad;
+};
+
+const GLuint frameDataBinding = 0;
+
+/// Программа огня; uniform-блок FrameData привязан к frameDataBinding.
+struct FireProgram {
+    GLuint id = 0;
+    bool fromBinary = false;    // loaded from the program binary cache
+};
+
+/// Собирает FireProgram вокруг уже слинкованной программы.
+FireProgram makeFireProgram(GLuint id) {
+    FireProgram program;
+    program.id = id;
+    GLuint block = glGetUniformBlockIndex(id, "FrameData");
+    if (block != GL_INVALID_INDEX)
+        glUniformBlockBinding(id, block, frameDataBinding);
+    return program;
+}
+
+FireProgram createFireProgram(const ShaderSources& sources, const ShaderVariant& variant,
+                              const ProgramBinaryCache* binaries = nullptr) {
+    bool fromBinary = false;
+    FireProgram program = makeFireProgram(createShaderProgram(sources, variant.header(), binaries, &fromBinary));
+    program.fromBinary = fromBinary;
+    return program;
+}
+
+/**
+ * @brief Кэш скомпилированных вариантов: каждый вариант собирается один раз.
+ *
+ * Варианты, которые понадобятся позже, ставятся в очередь prefetch() и
+ * собираются по одному за кадр в update(), уже после первого кадра.
+ * reload() пересобирает все варианты из новых исходников, не останавливая
+ * рендер: с KHR_parallel_shader_compile — в потоках драйвера, иначе — по одному
+ * варианту за кадр. Старая программа работает, пока новая не слинкуется.
+ */
+class ShaderCache {
+public:
+    ShaderCache(const ShaderSources& sources, const ProgramBinaryCache* binaries = nullptr, bool parallelCompile = false)
+        : sources(sources), binaries(binaries), parallelCompile(parallelCompile) {}
+    ShaderCache(const ShaderCache&) = delete;
+    ShaderCache& operator=(const ShaderCache&) = delete;
+
+    ~ShaderCache() { clear(); }
+
+    /// Удаляет все программы — вызывать, пока контекст ещё жив.
+    void clear() {
+        cancelReload();
+        for (auto& entry : programs)
+            glState.deleteProgram(entry.second.program.id);
+        programs.clear();
+    }
+
+    const FireProgram& get(const ShaderVariant& variant) {
+        auto it = programs.find(variant.key());
+        if (it == programs.end()) {
+            double start = glfwGetTime();
+            Entry entry{ variant, createFireProgram(sources, variant, binaries), generation };
+            it = programs.emplace(variant.key(), entry).first;
+            std::cout << "Program " << variant.name() << ": "
+                      << (it->second.program.fromBinary ? "binary cache" : "compiled") << ", "
+                      << int((glfwGetTime() - start) * 1000.0) << " ms" << std::endl;
+        }
+        return it->second.program;
+    }
+
+    /// Запоминает вариант для фоновой сборки.
+    void prefetch(const ShaderVariant& variant) {
+        if (!programs.count(variant.key()))
+            pending.push_back(variant);
+    }
+
+    /// Пересобирает все уже собранные варианты из новых исходников.
+    void reload(const ShaderSources& newSources) {
+        cancelReload();
+        reloadSources = newSources;
+        reloadGeneration = generation + 1;
+        reloading = true;
+        reloadStart = glfwGetTime();
+        for (auto& entry : programs)
+            queued.push_back(entry.second.variant);
+    }
+
+    /// Номер удачной перезагрузки исходников; меняется, когда программы заменены.
+    int sourceGeneration() const { return generation; }
+
+    /// Продвигает фоновые сборки; вызывать раз в кадр после glfwSwapBuffers.
+    void update() {
+        if (reloading) {
+            updateReload();
+            return;
+        }
+        if (pending.empty()) return;
+        get(pending.front());
+        pending.pop_front();
+    }
+
+private:
+    struct Entry {
+        ShaderVariant variant;
+        FireProgram program;
+        int generation;         // sources generation the program was built from
+    };
+
+    /// Программа, собираемая из reloadSources.
+    struct Build {
+        ShaderVariant variant;
+        GLuint vs, fs, prog;
+        std::string vertex, fragment;   // for ProgramBinaryCache::store
+    };
+
+    Build startBuild(const ShaderVariant& variant) {
+        std::string vertex = injectDefines(reloadSources.vertex, variant.header());
+        std::string fragment = injectDefines(reloadSources.fragment, variant.header());
+        Build build{ variant, glCreateShader(GL_VERTEX_SHADER), glCreateShader(GL_FRAGMENT_SHADER), glCreateProgram(),
+                     std::move(vertex), std::move(fragment) };
+        const char* vsSrc = build.vertex.c_str();
+        const char* fsSrc = build.fragment.c_str();
+        glShaderSource(build.vs, 1, &vsSrc, nullptr);
+        glShaderSource(build.fs, 1, &fsSrc, nullptr);
+        // No status queries here: with KHR_parallel_shader_compile they would block
+        glCompileShader(build.vs);
+        glCompileShader(build.fs);
+        if (binaries) binaries->prepare(build.prog);
+        glAttachShader(build.prog, build.vs);
+        glAttachShader(build.prog, build.fs);
+        glLinkProgram(build.prog);
+        return build;
+    }
+
+    bool buildReady(const Build& build) const {
+        if (!parallelCompile) return true;
+        GLint done = 0;
+        glGetProgramiv(build.prog, GL_COMPLETION_STATUS_KHR, &done);
+        return done != 0;
+    }
+
+    /// Завершает сборку: при успехе заменяет программу варианта, иначе печатает журналы.
+    bool finishBuild(Build& build) {
+        GLint linked = 0;
+        glGetProgramiv(build.prog, GL_LINK_STATUS, &linked);
+        if (!linked) {
+            std::cerr << "Shader reload failed (" << build.variant.name() << "), keeping the previous programs\n";
+            for (GLuint shader : { build.vs, build.fs }) {
+                GLint compiled = 0;
+                glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+                if (!compiled)
+                    std::cerr << (shader == build.vs ? "shader.vert" : "shader.frag") << ":\n" << shaderInfoLog(shader);
+            }
+            std::cerr << programInfoLog(build.prog) << std::endl;
+        }
+        glDeleteShader(build.vs);
+        glDeleteShader(build.fs);
+        if (!linked) {
+            glState.deleteProgram(build.prog);
+            return false;
+        }
+        if (binaries) binaries->store(build.prog, build.vertex, build.fragment);
+        bindFireSamplers(build.prog);
+        Entry& entry = programs.at(build.variant.key());
+        glState.deleteProgram(entry.program.id);
+        entry.program = makeFireProgram(build.prog);
+        entry.generation = reloadGeneration;
+        return true;
+    }
+
+    void updateReload() {
+        // Without parallel compile each build blocks, so start only one per frame
+        while (!queued.empty() && (parallelCompile || building.empty())) {
+            building.push_back(startBuild(queued.front()));
+            queued.pop_front();
+        }
+        for (auto it = building.begin(); it != building.end();) {
+            if (!buildReady(*it)) {
+                ++it;
+                continue;
+            }
+            bool ok = finishBuild(*it);
+            it = building.erase(it);
+            if (!ok) {
+                cancelReload();
+                return;
+            }
+        }
+        if (!queued.empty() || !building.empty()) return;
+
+        // Variants first built during the reload still come from the old sources.
+        // From here on get() builds from reloadSources and stamps reloadGeneration too
+        sources = reloadSources;
+        generation = reloadGeneration;
+        for (auto& entry : programs)
+            if (entry.second.generation < reloadGeneration)
+                queued.push_back(entry.second.variant);
+        if (!queued.empty()) return;
+        reloading = false;
+        std::cout << "Shaders reloaded: " << programs.size() << " programs, "
+                  << int((glfwGetTime() - reloadStart) * 1000.0) << " ms" << std::endl;
+    }
+
+    void cancelReload() {
+        for (Build& build : building) {
+            glDeleteShader(build.vs);
+            glDeleteShader(build.fs);
+            glState.deleteProgram(build.prog);
+        }
+        building.clear();
+        queued.clear();
+        reloading = false;
+    }
+
+    ShaderSources sources;              // last sources that built successfully
+    const ProgramBinaryCache* binaries;
+    bool parallelCompile;
+    std::map<uint32_t, Entry> programs;
+    std::deque<ShaderVariant> pending;
+    int generation = 0;
+
+    ShaderSources reloadSources;
+    int reloadGeneration = 0;           // stamped on every program built from reloadSources
+    bool reloading = false;
+    double reloadStart = 0.0;
+    std::deque<ShaderVariant> queued;   // waiting to be started
+    std::vector<Build> building;        // compiling / linking
+};
+
+// ---------- Shader Hot Reload ----------
+
+/// Читает файл целиком; false — файла нет или он не читается.
+bool readTextFile(const std::string& path, std::string& text) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    std::ostringstream buffer;
+    buffer << in.rdbuf();
+    text = buffer.str();
+    return true;
+}
+
+/**
+ * @brief Следит за src/shader.vert и src/shader.frag по времени изменения.
+ */
+class ShaderWatcher {
+public:
+    static constexpr double pollInterval = 0.25;   // seconds between mtime checks
+
+    explicit ShaderWatcher(const std::string& dir) {
+        if (dir.empty()) return;
+        vertexPath = (std::filesystem::path(dir) / "shader.vert").string();
+        fragmentPath = (std::filesystem::path(dir) / "shader.frag").string();
+    }
+
+    bool enabled() const { return loaded; }
+
+    /// Читает оба файла; при неудаче sources не меняется.
+    bool load(ShaderSources& sources) {
+        if (vertexPath.empty()) return false;
+        ShaderSources files;
+        if (!readTextFile(vertexPath, files.vertex) || !readTextFile(fragmentPath, files.fragment))
+            return false;
+        vertexTime = writeTime(vertexPath);
+        fragmentTime = writeTime(fragmentPath);
+        sources = files;
+        loaded = true;
+        return true;
+    }
+
+    /// true, если файлы изменились с последней загрузки (проверяется не чаще pollInterval).
+    bool changed() {
+        if (!loaded) return false;
+        double now = glfwGetTime();
+        if (now - lastPoll < pollInterval) return false;
+        lastPoll = now;
+        return writeTime(vertexPath) != vertexTime || writeTime(fragmentPath) != fragmentTime;
+    }
+
+private:
+    static std::filesystem::file_time_type writeTime(const std::string& path) {
+        std::error_code ec;
+        return std::filesystem::last_write_time(path, ec);
+    }
+
+    std::string vertexPath, fragmentPath;
+    std::filesystem::file_time_type vertexTime, fragmentTime;
+    double lastPoll = 0.0;
+    bool loaded = false;
+};
+
+// ---------- Fire Emitters ----------
+/**
+ * @brief Один огонь на экране: прямоугольник в NDC и параметры анимации.
+ */
+struct FireEmitter {
+    float x = 0.0f, y = 0.0f;               // centre, NDC
+    float width = 2.0f, height = 2.0f;      // full size, NDC (the default covers the screen)
+    float seedOffset = 0.0f;                // shifts the noise domain so fires do not look alike
+    float speed = 1.0f;                     // multiplier of the global animation time
+    int colorScheme = -1;                   // 0..2, -1 = the program's COLOR_SCHEME
+};
+
+/**
+ * @brief Ряды факелов, заполняющие экран (--emitters=N).
+ *
+ * @param mixedSchemes — циклически раздавать факелам цветовые схемы
+ */
+std::vector<FireEmitter> makeTorchWall(int count, bool mixedSchemes) {
+    int rows = (int)std::ceil(std::sqrt((float)count / 2.0f));
+    int columns = (count + rows - 1) / rows;
+    float cellWidth = 2.0f / columns, cellHeight = 2.0f / rows;
+    std::vector<FireEmitter> torches(count);
+    for (int i = 0; i < count; ++i) {
+        FireEmitter& torch = torches[i];
+        torch.x = -1.0f + cellWidth * (i % columns + 0.5f);
+        torch.y = -1.0f + cellHeight * (i / columns + 0.5f);
+        torch.width = cellWidth * 0.7f;
+        torch.height = cellHeight * 0.9f;
+        // Golden-ratio sequence: well spread seeds and speeds without an RNG
+        float phase = std::fmod(i * 0.6180339f, 1.0f);
+        torch.seedOffset = i * 1.618f;
+        torch.speed = 0.8f + 0.4f * phase;
+        torch.colorScheme = mixedSchemes ? i % 3 : -1;
+    }
+    return torches;
+}
+
+/**
+ * @brief Рисует все огни одним instanced-вызовом поверх общего noiseTex.
+ *
+ * Углы квада вершинный шейдер берёт из gl_VertexID, данные экземпляров — из
+ * буфера экземпляров (атрибуты 1 и 2, divisor 1). Огни за пределами экрана отсекаются на
+ * CPU перед загрузкой, так что в буфер попадают только видимые.
+ * Общие для кадра uniform'ы идут через кольцо FrameData (setFrame()).
+ *
+ * @param persistentFrameData — caps.bufferStorage
+ */
+class FireEmitters {
+public:
+    explicit FireEmitters(bool persistentFrameData)
+        : frameData(new UniformRing(frameDataBinding, sizeof(FrameData), persistentFrameData)) {
+        glGenVertexArrays(2, vaos);
+        glGenBuffers(1, &instanceVbo);
+        // vaos[0] steps through the emitters; vaos[1] keeps the first one for every
+        // tile instance of drawTiles()
+        for (int i = 0; i < 2; ++i) {
+            GLuint divisor = i == 0 ? 1 : 0x7FFFFFFF;
+            glState.bindVertexArray(vaos[i]);
+            glBindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)offsetof(Instance, rect));
+            glVertexAttribDivisor(1, divisor);
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)offsetof(Instance, params));
+            glVertexAttribDivisor(2, divisor);
+        }
+        glState.bindVertexArray(0);
+    }
+    FireEmitters(const FireEmitters&) = delete;
+    FireEmitters& operator=(const FireEmitters&) = delete;
+
+    ~FireEmitters() { clear(); }
+
+    /// Удаляет буферы — вызывать, пока контекст ещё жив.
+    void clear() {
+        if (!instanceVbo) return;
+        glDeleteBuffers(1, &instanceVbo);
+        glState.deleteVertexArrays(2, vaos);
+        instanceVbo = 0;
+        frameData.reset();
+    }
+
+    /// Пишет FrameData следующего draw()/drawTiles() — один раз за кадр.
+    void setFrame(const FrameData& data) { frameData->write(&data); }
+
+    std::vector<FireEmitter> emitters;
+
+    /// true, если хотя бы один огонь задаёт свою цветовую схему.
+    bool usesOwnSchemes() const {
+        for (const FireEmitter& emitter : emitters)
+            if (emitter.colorScheme >= 0) return true;
+        return false;
+    }
+
+    /// true, если один из огней закрывает весь экран — тогда очистка перед ним не нужна.
+    bool coversScreen() const {
+        for (const FireEmitter& e : emitters)
+            if (e.x - e.width * 0.5f <= -1.0f && e.x + e.width * 0.5f >= 1.0f &&
+                e.y - e.height * 0.5f <= -1.0f && e.y + e.height * 0.5f >= 1.0f)
+                return true;
+        return false;
+    }
+
+    /// Отсекает невидимые огни и загружает остальные; возвращает число видимых.
+    int upload() {
+        instances.clear();
+        for (const FireEmitter& e : emitters) {
+            float halfWidth = e.width * 0.5f, halfHeight = e.height * 0.5f;
+            if (halfWidth <= 0.0f || halfHeight <= 0.0f ||
+                e.x + halfWidth < -1.0f || e.x - halfWidth > 1.0f ||
+                e.y + halfHeight < -1.0f || e.y - halfHeight > 1.0f)
+                continue;
+            instances.push_back({ { e.x, e.y, halfWidth, halfHeight },
+                                  { e.seedOffset, e.speed, (float)e.colorScheme, 0.0f } });
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+        if (instances.size() > capacity) {
+            capacity = std::max(instances.size(), capacity * 2);
+            glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(Instance), nullptr, GL_DYNAMIC_DRAW);
+        }
+        if (!instances.empty())
+            glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(Instance), instances.data());
+        return (int)instances.size();
+    }
+
+    /// Число огней, загруженных последним upload().
+    int visibleCount() const { return (int)instances.size(); }
+
+    /// Буфер экземпляров: по два vec4 (rect, params) на видимый огонь.
+    GLuint instanceBuffer() const { return instanceVbo; }
+
+    /// Один draw call на все видимые огни (после upload()).
+    void draw() const {
+        if (instances.empty()) return;
+        glState.bindVertexArray(vaos[0]);
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 6, (GLsizei)instances.size());
+    }
+
+    /// Первый видимый огонь, разбитый на tileCount тайлов (программа с TILE_CLASS != 0).
+    void drawTiles(int tileCount) const {
+        if (instances.empty()) return;
+        glState.bindVertexArray(vaos[1]);
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 6, tileCount);
+    }
+
+private:
+    struct Instance {
+        float rect[4];      // centre.xy, half size.xy
+        float params[4];    // seed offset, speed, colour scheme, unused
+    };
+
+    GLuint vaos[2] = { 0, 0 };
+    GLuint instanceVbo = 0;
+    std::vector<Instance> instances;
+    size_t capacity = 0;
+    std::unique_ptr<UniformRing> frameData;
+};
+
+// ---------- GL Capabilities ----------
+/**
+ * @brief Возможности текущего OpenGL-контекста, определяемые при старте.
+ */
+struct GLCaps {
+    int major = 3, minor = 3;
+    bool computeShaders = false;   // GL 4.3 или ARB_compute_shader + ARB_shader_image_load_store
+    bool programBinary = false;    // GL 4.1 или ARB_get_program_binary, и драйвер отдаёт хотя бы один формат
+    bool parallelShaderCompile = false;   // KHR_parallel_shader_compile
+    bool bufferStorage = false;    // GL 4.4 или ARB_buffer_storage: persistent-mapped буферы
+    bool rgtc3d = false;           // драйвер принимает GL_COMPRESSED_RED_RGTC1 для GL_TEXTURE_3D
+};
+
+bool hasGLExtension(const char* name) {
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; ++i) {
+        const char* ext = (const char*)glGetStringi(GL_EXTENSIONS, i);
+        if (ext && strcmp(ext, name) == 0) return true;
+    }
+    return false;
+}
+
+bool glVersionAtLeast(const GLCaps& caps, int major, int minor) {
+    return caps.major > major || (caps.major == major && caps.minor >= minor);
+}
+
+/**
+ * @brief Определяет версию контекста и загружает функции GL 4.x.
+ *
+ * Вызывается один раз после gladLoadGLLoader; печатает драйвер и версию.
+ */
+GLCaps detectGLCaps() {
+    GLCaps caps;
+    glGetIntegerv(GL_MAJOR_VERSION, &caps.major);
+    glGetIntegerv(GL_MINOR_VERSION, &caps.minor);
+
+#ifndef GL_VERSION_4_3
+    glad_glDispatchCompute = (PFNGLDISPATCHCOMPUTEPROC)glfwGetProcAddress("glDispatchCompute");
+    glad_glBindImageTexture = (PFNGLBINDIMAGETEXTUREPROC)glfwGetProcAddress("glBindImageTexture");
+    glad_glMemoryBarrier = (PFNGLMEMORYBARRIERPROC)glfwGetProcAddress("glMemoryBarrier");
+#endif
+    caps.computeShaders = (glVersionAtLeast(caps, 4, 3) ||
+                           (hasGLExtension("GL_ARB_compute_shader") && hasGLExtension("GL_ARB_shader_image_load_store"))) &&
+                          glDispatchCompute && glBindImageTexture && glMemoryBarrier;
+
+#ifndef GL_VERSION_4_1
+    glad_glGetProgramBinary = (PFNGLGETPROGRAMBINARYPROC)glfwGetProcAddress("glGetProgramBinary");
+    glad_glProgramBinary = (PFNGLPROGRAMBINARYPROC)glfwGetProcAddress("glProgramBinary");
+    glad_glProgramParameteri = (PFNGLPROGRAMPARAMETERIPROC)glfwGetProcAddress("glProgramParameteri");
+#endif
+    GLint binaryFormats = 0;
+    if ((glVersionAtLeast(caps, 4, 1) || hasGLExtension("GL_ARB_get_program_binary")) &&
+        glGetProgramBinary && glProgramBinary && glProgramParameteri)
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binaryFormats);
+    caps.programBinary = binaryFormats > 0;
+
+#ifndef GL_KHR_parallel_shader_compile
+    glad_glMaxShaderCompilerThreadsKHR =
+        (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+    if (!glad_glMaxShaderCompilerThreadsKHR)   // ARB variant: same enums and signature
+        glad_glMaxShaderCompilerThreadsKHR =
+            (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)glfwGetProcAddress("glMaxShaderCompilerThreadsARB");
+#endif
+    caps.parallelShaderCompile = (hasGLExtension("GL_KHR_parallel_shader_compile") ||
+                                  hasGLExtension("GL_ARB_parallel_shader_compile")) && glMaxShaderCompilerThreadsKHR;
+    // Let the driver pick the number of compiler threads
+    if (caps.parallelShaderCompile)
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFFu);
+
+#ifndef GL_VERSION_4_4
+    glad_glBufferStorage = (PFNGLBUFFERSTORAGEPROC)glfwGetProcAddress("glBufferStorage");
+#endif
+    caps.bufferStorage = (glVersionAtLeast(caps, 4, 4) || hasGLExtension("GL_ARB_buffer_storage")) && glBufferStorage;
+
+    // Core GL only allows RGTC for 2D targets, so try a tiny upload before committing to a BC4 bake
+    GLuint probe;
+    glGenTextures(1, &probe);
+    glState.bindTexture(GL_TEXTURE_3D, probe);
+    std::vector<uint8_t> blocks(noiseSliceBytes(4, NoiseFormat::BC4) * 4);
+    caps.rgtc3d = uploadNoiseVolume(4, NoiseFormat::BC4, blocks.data());
+    glState.deleteTextures(1, &probe);
+    while (glGetError() != GL_NO_ERROR) {}
+
+    std::cout << "OpenGL " << glGetString(GL_VERSION) << " | " << glGetString(GL_RENDERER)
+              << " | compute: " << (caps.computeShaders ? "yes" : "no")
+              << " | program binary: " << (caps.programBinary ? "yes" : "no")
+              << " | parallel compile: " << (caps.parallelShaderCompile ? "yes" : "no")
+              << " | buffer storage: " << (caps.bufferStorage ? "yes" : "no")
+              << " | bc4 3d: " << (caps.rgtc3d ? "yes" : "no") << std::endl;
+    return caps;
+}
+
+// ---------- Render Graph ----------
+// Экранные проходы кадра (огонь, апскейл, искры, постобработка) каждый кадр
+// объявляются заново вместе со своими входами и выходом. По этому списку граф
+// решает, какие промежуточные буферы делят одну текстуру и какие очистки лишние.
+
+// Attributeless fullscreen triangle: bind any empty VAO and draw 3 vertices.
+// Clip-space corners (-1, -1), (3, -1), (-1, 3) cover the viewport with no diagonal seam.
+const char* fullscreenVertexSrc = GLSL(
+    void main() {
+        vec2 corner = vec2(float((gl_VertexID & 1) << 2), float((gl_VertexID & 2) << 1)) - 1.0;
+        gl_Position = vec4(corner, 0.0, 1.0);
+    }
+);
+
+/// Рисует fullscreenVertexSrc; vao — пустой VAO без атрибутов (его требует core profile).
+void drawFullscreenTriangle(GLuint vao) {
+    glState.bindVertexArray(vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+/**
+ * @brief Граф экранных проходов одного кадра.
+ *
+ * Кадр объявляется после reset(): цели (importTarget — готовый FBO вроде
+ * default framebuffer, createTarget — промежуточная текстура) и проходы по
+ * порядку исполнения. execute() раздаёт промежуточным целям текстуры из пула:
+ * цели одного размера и формата, чьи проходы не пересекаются, получают одну
+ * текстуру, а текстуры, не нужные кадру, удаляются. Перед каждым проходом
+ * привязывается FBO его выхода с полным вьюпортом; очистка выполняется только
+ * для Load::Clear и для Load::Keep по ещё не записанной промежуточной цели.
+ */
+class RenderGraph {
+public:
+    using Target = int;
+
+    enum class Load {
+        Keep,           // draws over what earlier passes wrote
+        Clear,          // needs a cleared target
+        Overwrite       // writes every pixel, so a clear would be wasted
+    };
+
+    RenderGraph() = default;
+    RenderGraph(const RenderGraph&) = delete;
+    RenderGraph& operator=(const RenderGraph&) = delete;
+
+    ~RenderGraph() { clear(); }
+
+    /// Удаляет текстуры пула — вызывать, пока контекст ещё жив.
+    void clear() {
+        for (const Texture& texture : pool) {
+            glDeleteFramebuffers(1, &texture.fbo);
+            glState.deleteTextures(1, &texture.id);
+        }
+        pool.clear();
+    }
+
+    /// Начинает объявление нового кадра.
+    void reset() {
+        targets.clear();
+        passes.clear();
+    }
+
+    Target importTarget(GLuint fbo, int width, int height) {
+        targets.push_back({ width, height, 0, fbo, -1 });
+        return (Target)targets.size() - 1;
+    }
+
+    /// Промежуточная цель: содержимое не переживает кадр.
+    Target createTarget(int width, int height, GLenum format) {
+        targets.push_back({ std::max(width, 1), std::max(height, 1), format, 0, -1 });
+        return (Target)targets.size() - 1;
+    }
+
+    void addPass(std::vector<Target> reads, Target write, Load load, std::function<void()> run) {
+        passes.push_back({ std::move(reads), write, load, std::move(run) });
+    }
+
+    int width(Target target) const { return targets[target].width; }
+    int height(Target target) const { return targets[target].height; }
+
+    /// Текстура промежуточной цели — для проходов, которые её читают.
+    GLuint texture(Target target) const { return pool[targets[target].texture].id; }
+
+    GLuint framebuffer(Target target) const {
+        const Desc& desc = targets[target];
+        return desc.format ? pool[desc.texture].fbo : desc.fbo;
+    }
+
+    /// Размещает промежуточные цели и исполняет проходы по порядку.
+    void execute() {
+        allocate();
+        std::vector<bool> written(targets.size(), false);
+        for (const Pass& pass : passes) {
+            const Desc& desc = targets[pass.write];
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer(pass.write));
+            glViewport(0, 0, desc.width, desc.height);
+            bool undefined = desc.format && !written[pass.write];
+            if (pass.load == Load::Clear || (pass.load == Load::Keep && undefined))
+                glClear(GL_COLOR_BUFFER_BIT);
+            written[pass.write] = true;
+            pass.run();
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+private:
+    struct Desc {
+        int width, height;
+        GLenum format;      // 0 = imported
+        GLuint fbo;         // imported framebuffer
+        int texture;        // pool index of a transient target
+    };
+
+    struct Pass {
+        std::vector<Target> reads;
+        Target write;
+        Load load;
+        std::function<void()> run;
+    };
+
+    struct Texture {
+        int width, height;
+        GLenum format;
+        GLuint id, fbo;
+        int busyUntil;      // last pass of this frame that uses it
+    };
+
+    void allocate() {
+        // Lifetime of every target: first and last pass that touches it
+        std::vector<int> first(targets.size(), -1), last(targets.size(), -1);
+        for (int i = 0; i < (int)passes.size(); ++i) {
+            std::vector<Target> used = passes[i].reads;
+            used.push_back(passes[i].write);
+            for (Target t : used) {
+                if (first[t] < 0) first[t] = i;
+                last[t] = i;
+            }
+        }
+        for (Texture& texture : pool) texture.busyUntil = -2;
+
+        // Targets are visited in the order they come alive
+        std::vector<Target> order;
+        for (Target t = 0; t < (Target)targets.size(); ++t)
+            if (targets[t].format && first[t] >= 0) order.push_back(t);
+        std::stable_sort(order.begin(), order.end(), [&](Target a, Target b) { return first[a] < first[b]; });
+        bool changed = false;
+        for (Target t : order) {
+            Desc& desc = targets[t];
+            desc.texture = -1;
+            for (int i = 0; i < (int)pool.size() && desc.texture < 0; ++i) {
+                const Texture& texture = pool[i];
+                if (texture.width == desc.width && texture.height == desc.height &&
+                    texture.format == desc.format && texture.busyUntil < first[t])
+                    desc.texture = i;
+            }
+            if (desc.texture < 0) {
+                pool.push_back(createTexture(desc));
+                desc.texture = (int)pool.size() - 1;
+                changed = true;
+            }
+            pool[desc.texture].busyUntil = last[t];
+        }
+
+        // Drop what this frame did not need (old window sizes, disabled passes)
+        for (size_t i = pool.size(); i-- > 0;) {
+            if (pool[i].busyUntil != -2) continue;
+            glDeleteFramebuffers(1, &pool[i].fbo);
+            glState.deleteTextures(1, &pool[i].id);
+            pool.erase(pool.begin() + i);
+            for (Desc& desc : targets)
+                if (desc.format && desc.texture > (int)i) --desc.texture;
+            changed = true;
+        }
+        if (changed && !order.empty()) {
+            double megabytes = 0.0;
+            for (const Texture& texture : pool)
+                megabytes += (double)texture.width * texture.height * (texture.format == GL_RGBA16F ? 8 : 4) / (1 << 20);
+            std::cout << "Render graph: " << order.size() << " transient targets in " << pool.size()
+                      << " textures, " << std::fixed << std::setprecision(1) << megabytes << " MB"
+                      << std::defaultfloat << std::endl;
+        }
+    }
+
+    static Texture createTexture(const Desc& desc) {
+        Texture texture = { desc.width, desc.height, desc.format, 0, 0, -2 };
+        glGenTextures(1, &texture.id);
+        glState.bindTexture(GL_TEXTURE_2D, texture.id);
+        glTexImage2D(GL_TEXTURE_2D, 0, desc.format, desc.width, desc.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glGenFramebuffers(1, &texture.fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, texture.fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture.id, 0);
+        return texture;
+    }
+
+    std::vector<Desc> targets;
+    std::vector<Pass> passes;
+    std::vector<Texture> pool;
+};
+
+// ---------- GPU Noise Bake ----------
+// Порт PerlinNoise3D::noise на GLSL. Таблица перестановок читается из
+// 1D-текстуры R32I на 512 элементов, формула совпадает со скалярной,
+// включая замыкание решётки с периодом `period` (256 — без тайлинга).
+const char* perlinNoiseGLSL = GLSL_CODE(
+uniform isampler1D permTex;
+uniform int period;
+
+int perm(int i) { return texelFetch(permTex, i, 0).r; }
+
+float fade(float t) { return t * t * t * (t * (t * 6.0 - 15.0) + 10.0); }
+
+float grad(int hash, float x, float y, float z) {
+    int h = hash & 15;
+    float u = h < 8 ? x : y;
+    float v = h < 4 ? y : (h == 12 || h == 14 ? x : z);
+    return ((h & 1) != 0 ? -u : u) + ((h & 2) != 0 ? -v : v);
+}
+
+float perlinNoise(vec3 p) {
+    vec3 f = floor(p);
+    ivec3 c = ivec3(mod(f, float(period)));
+    ivec3 c1 = ivec3(notEqual(c + 1, ivec3(period))) * (c + 1);
+    int X = c.x;
+    int Y = c.y;
+    int Z = c.z;
+    int dz = c1.z - c.z;
+    p -= f;
+
+    float u = fade(p.x);
+    float v = fade(p.y);
+    float w = fade(p.z);
+    int A = perm(X) + Y;
+    int AA = perm(A) + Z;
+    int AB = perm(perm(X) + c1.y) + Z;
+    int B = perm(c1.x) + Y;
+    int BA = perm(B) + Z;
+    int BB = perm(perm(c1.x) + c1.y) + Z;
+
+    return mix(
+        mix(
+            mix(grad(perm(AA), p.x, p.y, p.z), grad(perm(BA), p.x - 1.0, p.y, p.z), u),
+            mix(grad(perm(AB), p.x, p.y - 1.0, p.z), grad(perm(BB), p.x - 1.0, p.y - 1.0, p.z), u),
+            v),
+        mix(
+            mix(grad(perm(AA + dz), p.x, p.y, p.z - 1.0), grad(perm(BA + dz), p.x - 1.0, p.y, p.z - 1.0), u),
+            mix(grad(perm(AB + dz), p.x, p.y - 1.0, p.z - 1.0), grad(perm(BB + dz), p.x - 1.0, p.y - 1.0, p.z - 1.0), u),
+            v),
+        w);
+}
+);
+
+// GL 4.3: один dispatch пишет весь объём через imageStore.
+// NOISE_IMAGE_FORMAT (r32f/r16f/r8) подставляется при сборке исходника.
+const char* noiseBakeComputeSrc = GLSL_CODE(
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+layout(NOISE_IMAGE_FORMAT) writeonly uniform image3D volume;
+uniform int size;
+uniform float frequency;
+
+void main() {
+    ivec3 c = ivec3(gl_GlobalInvocationID);
+    if (c.x >= size || c.y >= size || c.z >= size) return;
+    float n = perlinNoise(vec3(c) * frequency);
+    imageStore(volume, c, vec4(0.5 + 0.5 * n));
+}
+);
+
+// GL 3.3: объём заполняется послойно, каждый z-срез — отдельный рендер в FBO
+const char* noiseBakeFragmentSrc = GLSL_CODE(
+out float value;
+uniform int slice;
+uniform float frequency;
+
+void main() {
+    vec3 c = vec3(floor(gl_FragCoord.xy), float(slice));
+    value = 0.5 + 0.5 * perlinNoise(c * frequency);
+}
+);
+
+// Сумма октав FBM из объёма шума — тот же ряд, что fbm() во фрагментном шейдере.
+// Октава i читается с LOD i: шаг выборки 2^i текселя, так объём не алиасится.
+// G и B — та же сумма, сдвинутая на 0.5 по x и y (поля тепловых искажений).
+const char* fbmBakeFragmentSrc = GLSL(
+out vec4 value;
+uniform sampler3D noiseTex;
+uniform int slice;
+uniform float size;
+
+float octaves(vec3 p) {
+    float v = 0.0;
+    float a = 0.5;
+    for (int i = 0; i < 6; i++) {
+        v += a * textureLod(noiseTex, p, float(i)).r;
+        p *= 2.0;
+        a *= 0.5;
+    }
+    return v;
+}
+
+void main() {
+    vec3 p = (vec3(floor(gl_FragCoord.xy), float(slice)) + 0.5) / size;
+    value = vec4(octaves(p), octaves(p + vec3(0.5, 0.0, 0.0)), octaves(p + vec3(0.0, 0.5, 0.0)), 1.0);
+}
+);
+
+/**
+ * @brief Линкует программу и возвращает 0, если линковка не удалась.
+ */
+GLuint linkProgram(const std::vector<GLuint>& shaders) {
+    GLuint prog = glCreateProgram();
+    for (GLuint s : shaders) glAttachShader(prog, s);
+    glLinkProgram(prog);
+    for (GLuint s : shaders) glDeleteShader(s);
+
+    int success;
+    glGetProgramiv(prog, GL_LINK_STATUS, &success);
+    if (!success) {
+        std::cerr << "Program link error:\n" << programInfoLog(prog) << std::endl;
+        glState.deleteProgram(prog);
+        return 0;
+    }
+    return prog;
+}
+
+/**
+ * @brief Запекает объём шума Перлина целиком на GPU.
+ *
+ * На GL 4.3 используется compute-шейдер, иначе — послойный рендер
+ * фрагментным шейдером в слои 3D-текстуры. Данные не проходят через
+ * CPU: на хост выгружается только таблица перестановок (2 КБ).
+ *
+ * @param vao — пустой VAO для drawFullscreenTriangle (фрагментный путь)
+ * @return GLuint — ID текстуры или 0, если GPU-путь недоступен
+ *         (в том числе для сжатого BC4, который кодируется только на CPU)
+ */
+GLuint create3DNoiseTextureGPU(const NoiseSettings& settings, const GLCaps& caps, GLuint vao) {
+    if (settings.format == NoiseFormat::BC4) return 0;
+    int size = settings.size;
+    const NoiseFormatDesc& desc = noiseFormatDesc(settings.format);
+    PerlinNoise3D perlin(settings.seed, settings.period());
+    const std::vector<int>& table = perlin.permutation();
+
+    double start = glfwGetTime();
+    GLuint program = 0;
+    if (caps.computeShaders) {
+        std::string src = std::string("#version 430 core\n#define NOISE_IMAGE_FORMAT ") + desc.name + "\n" +
+                          perlinNoiseGLSL + noiseBakeComputeSrc;
+        program = linkProgram({ compileShader(GL_COMPUTE_SHADER, src.c_str()) });
+    }
+    else {
+        std::string fs = std::string("#version 330 core\n") + perlinNoiseGLSL + noiseBakeFragmentSrc;
+        program = linkProgram({ compileShader(GL_VERTEX_SHADER, fullscreenVertexSrc),
+                                compileShader(GL_FRAGMENT_SHADER, fs.c_str()) });
+    }
+    if (!program) return 0;
+
+    GLuint permTex;
+    glGenTextures(1, &permTex);
+    glState.bindTexture(GL_TEXTURE_1D, permTex);
+    glTexImage1D(GL_TEXTURE_1D, 0, GL_R32I, (GLsizei)table.size(), 0, GL_RED_INTEGER, GL_INT, table.data());
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glState.bindTexture(GL_TEXTURE_3D, tex);
+    glTexImage3D(GL_TEXTURE_3D, 0, desc.internalFormat, size, size, size, 0, GL_RED, desc.type, nullptr);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+    glState.useProgram(program);
+    glState.activeTexture(GL_TEXTURE1);
+    glState.bindTexture(GL_TEXTURE_1D, permTex);
+    glUniform1i(glGetUniformLocation(program, "permTex"), 1);
+    glUniform1f(glGetUniformLocation(program, "frequency"), settings.bakeFrequency());
+    glUniform1i(glGetUniformLocation(program, "period"), perlin.latticePeriod());
+
+    GLuint query;
+    glGenQueries(1, &query);
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    if (caps.computeShaders) {
+        glBindImageTexture(0, tex, 0, GL_TRUE, 0, GL_WRITE_ONLY, desc.internalFormat);
+        glUniform1i(glGetUniformLocation(program, "volume"), 0);
+        glUniform1i(glGetUniformLocation(program, "size"), size);
+        GLuint groups = (GLuint)(size + 7) / 8;
+        glDispatchCompute(groups, groups, (GLuint)size);
+        // Sampling and glGenerateMipmap in setNoiseSampling both read the image writes
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+    }
+    else {
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        GLuint fbo;
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glViewport(0, 0, size, size);
+        int sliceLoc = glGetUniformLocation(program, "slice");
+        for (int z = 0; z < size; ++z) {
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, tex, 0, z);
+            glUniform1i(sliceLoc, z);
+            drawFullscreenTriangle(vao);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &fbo);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    }
+    glEndQuery(GL_TIME_ELAPSED);
+
+    glState.bindTexture(GL_TEXTURE_3D, tex);
+    setNoiseSampling(settings.tiling);
+
+    GLuint64 gpuNs = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &gpuNs);
+    glDeleteQueries(1, &query);
+    glState.deleteTextures(1, &permTex);
+    glState.deleteProgram(program);
+    glState.activeTexture(GL_TEXTURE0);
+
+    std::cout << "Noise bake: " << size << "^3 " << desc.name << ", GPU "
+              << (caps.computeShaders ? "compute shader" : "fragment slices")
+              << ", " << int(gpuNs / 1000000) << " ms GPU, "
+              << int((glfwGetTime() - start) * 1000.0) << " ms total" << std::endl;
+    return tex;
+}
+
+/**
+ * @brief Запекает FBM-объём RGBA8 из готового объёма шума послойным рендером.
+ *
+ * Шесть октав сворачиваются в одну выборку; работает на GL 3.3 с любым
+ * путём получения noiseTex (GPU, CPU, кэш). Нужен тайлящийся объём с mip-уровнями.
+ *
+ * @return GLuint — ID текстуры или 0, если FBM-объём недоступен
+ */
+GLuint createFBMVolume(GLuint noiseTex, const NoiseSettings& settings, GLuint vao) {
+    if (!settings.tiling) {
+        std::cerr << "FBM volume needs the tiling noise volume, ignored with --no-tiling" << std::endl;
+        return 0;
+    }
+    GLuint program = linkProgram({ compileShader(GL_VERTEX_SHADER, fullscreenVertexSrc),
+                                   compileShader(GL_FRAGMENT_SHADER, fbmBakeFragmentSrc) });
+    if (!program) return 0;
+
+    int size = settings.size;
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glState.bindTexture(GL_TEXTURE_3D, tex);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA8, size, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+    glState.useProgram(program);
+    glState.activeTexture(GL_TEXTURE0);
+    glState.bindTexture(GL_TEXTURE_3D, noiseTex);
+    glUniform1i(glGetUniformLocation(program, "noiseTex"), 0);
+    glUniform1f(glGetUniformLocation(program, "size"), (float)size);
+    int sliceLoc = glGetUniformLocation(program, "slice");
+
+    GLuint query;
+    glGenQueries(1, &query);
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    GLuint fbo;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, size, size);
+    for (int z = 0; z < size; ++z) {
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, tex, 0, z);
+        glUniform1i(sliceLoc, z);
+        drawFullscreenTriangle(vao);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glEndQuery(GL_TIME_ELAPSED);
+
+    glState.bindTexture(GL_TEXTURE_3D, tex);
+    setNoiseSampling(true);
+
+    GLuint64 gpuNs = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &gpuNs);
+    glDeleteQueries(1, &query);
+    glState.deleteProgram(program);
+
+    std::cout << "FBM volume: " << size << "^3 rgba8, " << size * size * size * 4 / (1024 * 1024) << " MB, "
+              << int(gpuNs / 1000000) << " ms GPU" << std::endl;
+    return tex;
+}
+
+// ---------- Reduced-Resolution Rendering ----------
+// Огонь — низкочастотный сигнал, поэтому его можно считать в уменьшенном
+// разрешении. Каждый кадр рендерится со своим субпиксельным сдвигом (Halton 2,3),
+// а полноразмерная история, сдвинутая вдоль известного потока огня,
+// накапливает недостающие детали.
+
+const char* upscaleFragmentSrc = GLSL(
+out vec4 FragColor;
+uniform sampler2D current;      // reduced-resolution frame in the lower-left corner
+uniform sampler2D history;      // previous full-resolution output
+uniform vec2 outputSize;
+uniform float scale;            // rendered part of `current`
+uniform vec2 jitter;            // sub-pixel offset of `current`, in output uv
+uniform vec2 flow;              // where this pixel's content was a frame ago, in output uv
+uniform float historyWeight;    // 0 = no usable history
+
+void main() {
+    vec2 st = gl_FragCoord.xy / outputSize;
+    vec2 texel = 1.0 / outputSize;
+    vec2 lo = 0.5 * texel;
+    vec2 hi = vec2(scale) - 0.5 * texel;
+    vec2 c = (st - jitter) * scale;
+    vec3 color = texture(current, clamp(c, lo, hi)).rgb;
+
+    // Clamp the history to the local colour range to reject smoke that did not follow the flow
+    vec3 n0 = texture(current, clamp(c + vec2(texel.x, 0.0), lo, hi)).rgb;
+    vec3 n1 = texture(current, clamp(c - vec2(texel.x, 0.0), lo, hi)).rgb;
+    vec3 n2 = texture(current, clamp(c + vec2(0.0, texel.y), lo, hi)).rgb;
+    vec3 n3 = texture(current, clamp(c - vec2(0.0, texel.y), lo, hi)).rgb;
+    vec3 minColor = min(color, min(min(n0, n1), min(n2, n3)));
+    vec3 maxColor = max(color, max(max(n0, n1), max(n2, n3)));
+
+    vec2 h = st + flow;
+    float weight = all(greaterThanEqual(h, vec2(0.0))) && all(lessThanEqual(h, vec2(1.0))) ? historyWeight : 0.0;
+    vec3 previous = clamp(texture(history, h).rgb, minColor, maxColor);
+    FragColor = vec4(mix(color, previous, weight), 1.0);
+}
+);
+
+/// Элемент последовательности Холтона по основанию base (index >= 1).
+float halton(int index, int base) {
+    float f = 1.0f, r = 0.0f;
+    for (; index > 0; index /= base) {
+        f /= base;
+        r += f * (index % base);
+    }
+    return r;
+}
+
+/**
+ * @brief Рендер огня в уменьшенном разрешении с временным апскейлом.
+ *
+ * begin() выбирает субпиксельный сдвиг кадра; проход огня рисует в
+ * промежуточную цель графа формата reducedFormat размером с выход, ограничив
+ * себя setReducedViewport(), а addResolve() собирает из неё и истории полный
+ * кадр. Цель уменьшенного кадра всегда полноразмерная, поэтому смена масштаба
+ * не меняет текстуры графа.
+ */
+class TemporalUpscaler {
+public:
+    /// Доля истории в итоговом пикселе.
+    static constexpr float historyWeight = 0.9f;
+    static const int jitterPhases = 8;
+    static const GLenum reducedFormat = GL_RGBA8;
+
+    TemporalUpscaler() {
+        program = linkProgram({ compileShader(GL_VERTEX_SHADER, fullscreenVertexSrc),
+                                compileShader(GL_FRAGMENT_SHADER, upscaleFragmentSrc) });
+        glState.useProgram(program);
+        glUniform1i(glGetUniformLocation(program, "current"), 2);
+        glUniform1i(glGetUniformLocation(program, "history"), 3);
+        outputSizeLoc = glGetUniformLocation(program, "outputSize");
+        scaleLoc = glGetUniformLocation(program, "scale");
+        jitterLoc = glGetUniformLocation(program, "jitter");
+        flowLoc = glGetUniformLocation(program, "flow");
+        historyWeightLoc = glGetUniformLocation(program, "historyWeight");
+        glGenFramebuffers(2, fbos);
+        glGenTextures(2, textures);
+    }
+
+    ~TemporalUpscaler() {
+        glDeleteFramebuffers(2, fbos);
+        glState.deleteTextures(2, textures);
+        glState.deleteProgram(program);
+    }
+
+    TemporalUpscaler(const TemporalUpscaler&) = delete;
+    TemporalUpscaler& operator=(const TemporalUpscaler&) = delete;
+
+    /**
+     * @brief Начинает кадр уменьшенного разрешения.
+     *
+     * @param scale — доля разрешения по каждой оси (0, 1]
+     * @param uvOffset — сюда пишется субпиксельный сдвиг для uniform uvOffset
+     */
+    void begin(int outputWidth, int outputHeight, float scale, float uvOffset[2]) {
+        if (outputWidth != width || outputHeight != height)
+            resize(outputWidth, outputHeight);
+        currentScale = scale;
+        reducedWidth = std::max(1, (int)std::lround(width * scale));
+        reducedHeight = std::max(1, (int)std::lround(height * scale));
+        // Keep the jitter inside one reduced-resolution pixel
+        int phase = frame++ % jitterPhases + 1;
+        jitter[0] = (halton(phase, 2) - 0.5f) / reducedWidth;
+        jitter[1] = (halton(phase, 3) - 0.5f) / reducedHeight;
+        uvOffset[0] = jitter[0];
+        uvOffset[1] = jitter[1];
+    }
+
+    /// Вьюпорт уменьшенного кадра в левом нижнем углу цели — для прохода огня.
+    void setReducedViewport() const { glViewport(0, 0, reducedWidth, reducedHeight); }
+
+    /**
+     * @brief Добавляет в граф сборку полного кадра из reduced и истории в output.
+     *
+     * @param flowY — сдвиг содержимого по вертикали с прошлого кадра (в uv)
+     */
+    void addResolve(RenderGraph& graph, RenderGraph::Target reduced, RenderGraph::Target output,
+                    float flowY, GLuint vao) {
+        graph.addPass({ reduced }, output, RenderGraph::Load::Overwrite, [this, &graph, reduced, output, flowY, vao] {
+            resolve(graph.texture(reduced), graph.framebuffer(output), flowY, vao);
+        });
+    }
+
+    /// Забывает историю: следующий кадр собирается только из текущего.
+    void invalidateHistory() { historyValid = false; }
+
+private:
+    void resolve(GLuint reduced, GLuint target, float flowY, GLuint vao) {
+        int write = historyIndex, read = 1 - historyIndex;
+        glBindFramebuffer(GL_FRAMEBUFFER, fbos[write]);
+        glViewport(0, 0, width, height);
+        glState.useProgram(program);
+        glState.activeTexture(GL_TEXTURE2);
+        glState.bindTexture(GL_TEXTURE_2D, reduced);
+        glState.activeTexture(GL_TEXTURE3);
+        glState.bindTexture(GL_TEXTURE_2D, textures[read]);
+        glState.activeTexture(GL_TEXTURE0);
+        glUniform2f(outputSizeLoc, (float)width, (float)height);
+        glUniform1f(scaleLoc, currentScale);
+        glUniform2f(jitterLoc, jitter[0], jitter[1]);
+        glUniform2f(flowLoc, 0.0f, flowY);
+        glUniform1f(historyWeightLoc, historyValid ? historyWeight : 0.0f);
+        drawFullscreenTriangle(vao);
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, fbos[write]);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, target);
+        historyIndex ^= 1;
+        historyValid = true;
+    }
+
+    void resize(int w, int h) {
+        width = w;
+        height = h;
+        // History ping-pong; it outlives the frame, so it is not a graph target
+        for (int i = 0; i < 2; ++i) {
+            glState.bindTexture(GL_TEXTURE_2D, textures[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glBindFramebuffer(GL_FRAMEBUFFER, fbos[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[i], 0);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        historyValid = false;
+    }
+
+    GLuint program = 0;
+    int outputSizeLoc, scaleLoc, jitterLoc, flowLoc, historyWeightLoc;
+    GLuint fbos[2];
+    GLuint textures[2];
+    int width = 0, height = 0;
+    int reducedWidth = 1, reducedHeight = 1;
+    float currentScale = 1.0f;
+    float jitter[2] = { 0.0f, 0.0f };
+    int frame = 0;
+    int historyIndex = 0;
+    bool historyValid = false;
+};
+
+/**
+ * @brief Подбирает масштаб рендера под целевое GPU-время кадра.
+ *
+ * Стоимость кадра пропорциональна площади, поэтому при перегрузке масштаб
+ * уменьшается на корень из отношения времён. Расти он может только
+ * медленно и только с запасом — так масштаб не колеблется.
+ */
+struct RenderScaleController {
+    static constexpr float minScale = 0.25f;
+    static constexpr float maxScale = 1.0f;
+    static const int settleFrames = 8;      // GPU timings arrive a few frames late
+
+    double targetMs = 16.0;
+    float scale = 1.0f;
+    int cooldown = 0;
+
+    void update(double gpuMs) {
+        if (gpuMs <= 0.0 || --cooldown > 0) return;
+        float next = scale;
+        if (gpuMs > targetMs)
+            next = scale * (float)std::sqrt(0.9 * targetMs / gpuMs);
+        else if (gpuMs < 0.7 * targetMs)
+            next = scale * 1.05f;
+        // Quantize so that small timing noise does not change the scale
+        next = std::min(std::max(std::round(next * 32.0f) / 32.0f, minScale), maxScale);
+        if (next != scale) {
+            scale = next;
+            cooldown = settleFrames;
+        }
+    }
+};
+
+/**
+ * @brief Регулятор качества (--quality=auto): держит GPU-время кадра у цели.
+ *
+ * Уровни — лестница от варианта, выбранного пользователем, к самому дешёвому:
+ * каждый шаг снимает одну ручку — октаву FBM, тепловое искажение, точность
+ * объёма шума (R8 вместо float), масштаб рендера, искры. Вниз регулятор идёт,
+ * как только сглаженное время выше цели; вверх — только если оно upshiftDelay
+ * кадров подряд ниже upshiftRatio цели. Если уровень, на который поднялись,
+ * снова перегружает GPU, задержка подъёма удваивается, так что регулятор не
+ * качается между двумя соседними уровнями.
+ */
+class QualityGovernor {
+public:
+    struct Level {
+        int octaves;
+        bool sparks, distortion;
+        bool lowNoise;              // sample the R8 copy of the noise volume
+        float scale;                // render scale, 1 = full resolution
+
+        std::string describe() const {
+            std::string text = std::to_string(octaves) + " octaves";
+            if (!distortion) text += ", no distortion";
+            if (!sparks) text += ", no sparks";
+            if (lowNoise) text += ", r8 noise";
+            return text + ", scale " + std::to_string(int(scale * 100.0f + 0.5f)) + "%";
+        }
+    };
+
+    static constexpr double upshiftRatio = 0.7;
+    static constexpr double smoothing = 0.1;
+    static const int settleFrames = 8;          // GPU timings arrive a few frames late
+    static const int downshiftFrames = 4;       // samples averaged before the first decision
+    static const int minUpshiftDelay = 120;
+    static const int maxUpshiftDelay = 3840;
+
+    QualityGovernor(const ShaderVariant& base, bool lowNoiseAvailable, double targetMs) : targetMs(targetMs) {
+        Level level{ base.octaves, base.sparks, base.distortion, false, 1.0f };
+        levels.push_back(level);
+        auto step = [this](Level next) {
+            const Level& last = levels.back();
+            if (next.octaves != last.octaves || next.sparks != last.sparks || next.distortion != last.distortion ||
+                next.lowNoise != last.lowNoise || next.scale != last.scale)
+                levels.push_back(next);
+        };
+        while (level.octaves > 4) {
+            level.octaves--;
+            step(level);
+        }
+        level.distortion = false;
+        step(level);
+        level.lowNoise = lowNoiseAvailable;
+        step(level);
+        level.scale = 0.75f;
+        step(level);
+        level.sparks = false;
+        step(level);
+        level.octaves = std::min(level.octaves, 3);
+        step(level);
+        level.scale = 0.5f;
+        step(level);
+    }
+
+    const Level& current() const { return levels[index]; }
+    int level() const { return (int)index; }
+    int levelCount() const { return (int)levels.size(); }
+
+    /// Вариант base с ручками уровня level (по умолчанию текущего).
+    ShaderVariant apply(ShaderVariant base, int level = -1) const {
+        const Level& l = levels[level < 0 ? index : std::min((size_t)level, levels.size() - 1)];
+        base.octaves = l.octaves;
+        base.sparks = l.sparks;
+        base.distortion = l.distortion;
+        return base;
+    }
+
+    /// Учитывает GPU-время последнего кадра; true, если уровень сменился.
+    bool update(double gpuMs) {
+        if (gpuMs <= 0.0) return false;
+        smoothedMs = smoothedMs < 0.0 ? gpuMs : smoothedMs + smoothing * (gpuMs - smoothedMs);
+        if (cooldown > 0) {
+            // Frames still in flight were rendered at the previous level
+            if (--cooldown == 0) smoothedMs = -1.0;
+            return false;
+        }
+        framesAtLevel++;
+        if (raised && framesAtLevel > upshiftDelay) {
+            // The raise held up, so the next one may come sooner again
+            upshiftDelay = std::max(minUpshiftDelay, upshiftDelay / 2);
+            raised = false;
+        }
+
+        if (smoothedMs > targetMs && framesAtLevel >= downshiftFrames && index + 1 < levels.size()) {
+            if (raised) upshiftDelay = std::min(upshiftDelay * 2, maxUpshiftDelay);
+            change(index + 1);
+            return true;
+        }
+        if (smoothedMs < upshiftRatio * targetMs && index > 0) {
+            if (++calmFrames >= upshiftDelay) {
+                change(index - 1);
+                raised = true;
+                return true;
+            }
+        }
+        else {
+            calmFrames = 0;
+        }
+        return false;
+    }
+
+    /// Сглаженное GPU-время, по которому принято последнее решение.
+    double lastMs() const { return lastDecisionMs; }
+
+private:
+    void change(size_t next) {
+        lastDecisionMs = smoothedMs;
+        index = next;
+        cooldown = settleFrames;
+        calmFrames = 0;
+        framesAtLevel = 0;
+        raised = false;
+    }
+
+    double targetMs;
+    std::vector<Level> levels;
+    size_t index = 0;
+    double smoothedMs = -1.0;
+    double lastDecisionMs = 0.0;
+    int cooldown = 0;
+    int calmFrames = 0;
+    int framesAtLevel = 0;
+    int upshiftDelay = minUpshiftDelay;
+    bool raised = false;            // the last change went up and has not proven itself yet
+};
+
+// ---------- Post-Processing ----------
+// Размытие и свечение считаются по готовому кадру. Двойной фильтр Кавасе
+// уменьшает изображение вдвое на каждом уровне и собирает его обратно, так что
+// радиус растёт экспоненциально с числом уровней, а стоимость почти не меняется.
+
+const char* kawaseDownFragmentSrc = GLSL(
+out vec4 FragColor;
+uniform sampler2D source;
+uniform vec2 outputSize;
+uniform float offset;
+void main() {
+    vec2 uv = gl_FragCoord.xy / outputSize;
+    vec2 h = 0.5 / outputSize * offset;
+    vec3 sum = texture(source, uv).rgb * 4.0;
+    sum += texture(source, uv - h).rgb;
+    sum += texture(source, uv + h).rgb;
+    sum += texture(source, uv + vec2(h.x, -h.y)).rgb;
+    sum += texture(source, uv - vec2(h.x, -h.y)).rgb;
+    FragColor = vec4(sum / 8.0, 1.0);
+}
+);
+
+const char* kawaseUpFragmentSrc = GLSL(
+out vec4 FragColor;
+uniform sampler2D source;
+uniform vec2 outputSize;
+uniform float offset;
+void main() {
+    vec2 uv = gl_FragCoord.xy / outputSize;
+    vec2 h = 0.5 / outputSize * offset;
+    vec3 sum = texture(source, uv + vec2(-h.x * 2.0, 0.0)).rgb;
+    sum += texture(source, uv + vec2(h.x * 2.0, 0.0)).rgb;
+    sum += texture(source, uv + vec2(0.0, h.y * 2.0)).rgb;
+    sum += texture(source, uv + vec2(0.0, -h.y * 2.0)).rgb;
+    sum += texture(source, uv + vec2(-h.x, h.y)).rgb * 2.0;
+    sum += texture(source, uv + vec2(h.x, h.y)).rgb * 2.0;
+    sum += texture(source, uv + vec2(h.x, -h.y)).rgb * 2.0;
+    sum += texture(source, uv + vec2(-h.x, -h.y)).rgb * 2.0;
+    FragColor = vec4(sum / 12.0, 1.0);
+}
+);
+
+const char* postCompositeFragmentSrc = GLSL(
+out vec4 FragColor;
+uniform sampler2D scene;
+uniform sampler2D blurred;
+uniform vec2 outputSize;
+uniform float blurMix;
+uniform float bloomThreshold;
+uniform float bloomStrength;
+void main() {
+    vec2 st = gl_FragCoord.xy / outputSize;
+    vec3 color = texture(scene, st).rgb;
+    vec3 soft = texture(blurred, st).rgb;
+    color = mix(color, soft, blurMix);
+    // Sparks and the hottest tongues spill light over their surroundings
+    color += max(soft - bloomThreshold, 0.0) * bloomStrength;
+    FragColor = vec4(color, 1.0);
+}
+);
+
+/**
+ * @brief Цепочка постобработки: размытие двойным фильтром Кавасе и свечение.
+ *
+ * addPasses() добавляет в граф проходы, которые размывают сцену и смешивают
+ * результат со сценой в выходной цели. Уровней столько, чтобы
+ * radius = offset * 2^levels; каждый следующий уровень вчетверо меньше,
+ * поэтому даже шесть уровней стоят меньше одного прохода в половинном разрешении.
+ * Уровни — промежуточные цели графа: подъём вверх пишет в ту же текстуру, что
+ * и спуск на этом уровне, потому что спуск к этому моменту уже прочитан.
+ */
+class PostProcess {
+public:
+    static const int maxLevels = 6;
+    static constexpr float blurMix = 0.3f;
+    static constexpr float bloomThreshold = 0.8f;
+    static constexpr float bloomStrength = 0.8f;
+    /// Формат сцены и уровней: float, чтобы искры ярче 1.0 всё ещё светились.
+    static const GLenum sceneFormat = GL_RGBA16F;
+
+    /// @param radius — радиус размытия в пикселях полного разрешения (> 0)
+    explicit PostProcess(float radius) {
+        levels = std::min(std::max((int)std::ceil(std::log2(std::max(radius, 1.0f))), 1), maxLevels);
+        offset = std::max(radius, 1.0f) / (float)(1 << levels);
+        GLuint vs[3];
+        for (GLuint& shader : vs) shader = compileShader(GL_VERTEX_SHADER, fullscreenVertexSrc);
+        downProgram = linkProgram({ vs[0], compileShader(GL_FRAGMENT_SHADER, kawaseDownFragmentSrc) });
+        upProgram = linkProgram({ vs[1], compileShader(GL_FRAGMENT_SHADER, kawaseUpFragmentSrc) });
+        compositeProgram = linkProgram({ vs[2], compileShader(GL_FRAGMENT_SHADER, postCompositeFragmentSrc) });
+        for (GLuint prog : { downProgram, upProgram }) {
+            glState.useProgram(prog);
+            glUniform1i(glGetUniformLocation(prog, "source"), 2);
+            glUniform1f(glGetUniformLocation(prog, "offset"), offset);
+        }
+        glState.useProgram(compositeProgram);
+        glUniform1i(glGetUniformLocation(compositeProgram, "scene"), 2);
+        glUniform1i(glGetUniformLocation(compositeProgram, "blurred"), 3);
+        glUniform1f(glGetUniformLocation(compositeProgram, "blurMix"), blurMix);
+        glUniform1f(glGetUniformLocation(compositeProgram, "bloomThreshold"), bloomThreshold);
+        glUniform1f(glGetUniformLocation(compositeProgram, "bloomStrength"), bloomStrength);
+        downSizeLoc = glGetUniformLocation(downProgram, "outputSize");
+        upSizeLoc = glGetUniformLocation(upProgram, "outputSize");
+        compositeSizeLoc = glGetUniformLocation(compositeProgram, "outputSize");
+    }
+
+    ~PostProcess() {
+        glState.deleteProgram(downProgram);
+        glState.deleteProgram(upProgram);
+        glState.deleteProgram(compositeProgram);
+    }
+
+    PostProcess(const PostProcess&) = delete;
+    PostProcess& operator=(const PostProcess&) = delete;
+
+    /// Добавляет в граф размытие scene (формата sceneFormat) и композит в output того же размера.
+    void addPasses(RenderGraph& graph, RenderGraph::Target scene, RenderGraph::Target output, GLuint vao) {
+        int width = graph.width(scene), height = graph.height(scene);
+        RenderGraph::Target source = scene;
+        for (int i = 1; i <= levels; ++i)
+            source = addBlurPass(graph, source, width >> i, height >> i, downProgram, downSizeLoc, vao);
+        for (int i = levels - 1; i >= 1; --i)
+            source = addBlurPass(graph, source, width >> i, height >> i, upProgram, upSizeLoc, vao);
+
+        RenderGraph::Target blurred = source;
+        graph.addPass({ scene, blurred }, output, RenderGraph::Load::Overwrite, [this, &graph, scene, blurred, output, vao] {
+            glState.useProgram(compositeProgram);
+            glUniform2f(compositeSizeLoc, (float)graph.width(output), (float)graph.height(output));
+            glState.activeTexture(GL_TEXTURE2);
+            glState.bindTexture(GL_TEXTURE_2D, graph.texture(scene));
+            glState.activeTexture(GL_TEXTURE3);
+            glState.bindTexture(GL_TEXTURE_2D, graph.texture(blurred));
+            glState.activeTexture(GL_TEXTURE0);
+            drawFullscreenTriangle(vao);
+        });
+    }
+
+private:
+    RenderGraph::Target addBlurPass(RenderGraph& graph, RenderGraph::Target source, int width, int height,
+                                    GLuint prog, int sizeLoc, GLuint vao) {
+        RenderGraph::Target target = graph.createTarget(width, height, sceneFormat);
+        graph.addPass({ source }, target, RenderGraph::Load::Overwrite, [&graph, source, target, prog, sizeLoc, vao] {
+            glState.useProgram(prog);
+            glUniform2f(sizeLoc, (float)graph.width(target), (float)graph.height(target));
+            glState.activeTexture(GL_TEXTURE2);
+            glState.bindTexture(GL_TEXTURE_2D, graph.texture(source));
+            glState.activeTexture(GL_TEXTURE0);
+            drawFullscreenTriangle(vao);
+        });
+        return target;
+    }
+
+    int levels = 1;
+    float offset = 1.0f;
+    GLuint downProgram = 0, upProgram = 0, compositeProgram = 0;
+    int downSizeLoc, upSizeLoc, compositeSizeLoc;
+};
+
+// ---------- Tile Classification ----------
+// Верхняя часть огня — чистый дым, а там, где пламя слабое, искажение ничего
+// не сдвигает. Предпроход в разрешении тайлов оценивает FBM и раскладывает
+// тайлы по классам; каждый класс рисуется своей специализированной программой.
+
+const char* tileClassifyFragmentSrc = GLSL(
+out uint tileClass;
+uniform sampler3D noiseTex;
+uniform vec2 tileSize;          // tile extent in the emitter's [-1, 1] quad space
+uniform float fireTime;         // time * emitter speed
+uniform float seedOffset;
+uniform float calmThreshold;
+
+// Same lattice walk as the fire shader, truncated to the octaves that matter here
+float fbmEstimate(vec3 p) {
+    float v = 0.0;
+    float a = 0.5;
+    for (int i = 0; i < 4; i++) {
+        v += a * texture(noiseTex, p).r;
+        p *= 2.0;
+        a *= 0.5;
+    }
+    return v + a * 2.0;     // bounds octaves 5 and 6, so the estimate errs towards fire
+}
+
+void main() {
+    vec2 lo = -1.0 + floor(gl_FragCoord.xy) * tileSize;
+    vec2 hi = min(lo + tileSize, vec2(1.0));
+    vec2 uvLo = lo * 0.5 + 0.7;
+    vec2 uvHi = hi * 0.5 + 0.7;
+    // Above uv.y = 1 heightMask is 1: nothing but smoke is visible
+    if (uvLo.y >= 1.0) {
+        tileClass = 1u;
+        return;
+    }
+
+    // Largest visible fire over the corners and centre of the tile
+    float t = fireTime * 0.2;
+    float visibleFire = 0.0;
+    for (int i = 0; i < 5; i++) {
+        vec2 f = i < 4 ? vec2(float(i & 1), float(i >> 1)) : vec2(0.5);
+        vec2 uv = mix(uvLo, uvHi, f);
+        vec3 p = vec3((uv.x + seedOffset) * 1.5, uv.y * 2.5 + t, t * 0.5);
+        float fire = pow(min(fbmEstimate(p), 1.0), 3.0);
+        visibleFire = max(visibleFire, fire * (1.0 - smoothstep(0.2, 1.0, uv.y)));
+    }
+    tileClass = visibleFire < calmThreshold ? 2u : 3u;
+}
+);
+
+/**
+ * @brief Раскладывает тайлы огня по классам: дым, спокойный огонь, полный огонь.
+ *
+ * Результат — текстура R8UI с классом каждого тайла. Её читает вершинный шейдер
+ * программ с TILE_CLASS: тайлы чужих классов вырождаются, поэтому каждый
+ * класс — один instanced-вызов без чтения результатов на CPU.
+ */
+class TileClassifier {
+public:
+    static const int tilePixels = 16;
+    /// Видимый огонь (fire * (1 - heightMask)), ниже которого искажение не считается.
+    static constexpr float calmThreshold = 0.04f;
+
+    TileClassifier() {
+        program = linkProgram({ compileShader(GL_VERTEX_SHADER, fullscreenVertexSrc),
+                                compileShader(GL_FRAGMENT_SHADER, tileClassifyFragmentSrc) });
+        glState.useProgram(program);
+        glUniform1i(glGetUniformLocation(program, "noiseTex"), 0);
+        glUniform1f(glGetUniformLocation(program, "calmThreshold"), calmThreshold);
+        tileSizeLoc = glGetUniformLocation(program, "tileSize");
+        fireTimeLoc = glGetUniformLocation(program, "fireTime");
+        seedOffsetLoc = glGetUniformLocation(program, "seedOffset");
+        glGenFramebuffers(1, &fbo);
+        glGenTextures(1, &classes);
+    }
+
+    ~TileClassifier() {
+        glDeleteFramebuffers(1, &fbo);
+        glState.deleteTextures(1, &classes);
+        glState.deleteProgram(program);
+    }
+
+    TileClassifier(const TileClassifier&) = delete;
+    TileClassifier& operator=(const TileClassifier&) = delete;
+
+    /**
+     * @brief Классифицирует тайлы огня для текущего вьюпорта.
+     *
+     * Предполагает noiseTex на юните 0; восстанавливает FBO и вьюпорт.
+     * @return число тайлов (экземпляров для FireEmitters::drawTiles)
+     */
+    int classify(const FireEmitter& emitter, float time, GLuint vao) {
+        GLint viewport[4], framebuffer;
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+
+        // Tiles are square in pixels of the emitter's on-screen rectangle
+        float pixelsX = std::max(1.0f, emitter.width * 0.5f * viewport[2]);
+        float pixelsY = std::max(1.0f, emitter.height * 0.5f * viewport[3]);
+        int columns = (int)std::ceil(pixelsX / tilePixels), rows = (int)std::ceil(pixelsY / tilePixels);
+        tileSize[0] = 2.0f * tilePixels / pixelsX;
+        tileSize[1] = 2.0f * tilePixels / pixelsY;
+        if (columns != width || rows != height)
+            resize(columns, rows);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glViewport(0, 0, width, height);
+        glState.useProgram(program);
+        glUniform2f(tileSizeLoc, tileSize[0], tileSize[1]);
+        glUniform1f(fireTimeLoc, time * emitter.speed);
+        glUniform1f(seedOffsetLoc, emitter.seedOffset);
+        drawFullscreenTriangle(vao);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        glState.activeTexture(GL_TEXTURE4);
+        glState.bindTexture(GL_TEXTURE_2D, classes);
+        glState.activeTexture(GL_TEXTURE0);
+        return width * height;
+    }
+
+    /// Размер тайла в пространстве квада огня — для uniform tileSize.
+    const float* size() const { return tileSize; }
+
+private:
+    void resize(int w, int h) {
+        width = w;
+        height = h;
+        glState.bindTexture(GL_TEXTURE_2D, classes);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8UI, w, h, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, classes, 0);
+    }
+
+    GLuint program = 0;
+    int tileSizeLoc, fireTimeLoc, seedOffsetLoc;
+    GLuint fbo = 0, classes = 0;
+    int width = 0, height = 0;
+    float tileSize[2] = { 1.0f, 1.0f };
+};
+
+/**
+ * @brief Рисует все огни текущего кадра.
+ *
+ * Один огонь на экране с классификатором рисуется по классам тайлов,
+ * иначе — одним instanced-вызовом. Текстуры шума уже привязаны к юнитам 0, 1 и 5.
+ *
+ * @param noiseBlend — вес второго 4D-среза (NoiseTimeRing::update)
+ * @param loopLength — длина цикла для варианта с LOOP (time уже в [0, loopLength))
+ */
+void drawFires(FireEmitters& fires, ShaderCache& shaders, ShaderVariant variant, TileClassifier* tiles,
+               float time, const float uvOffset[2], GLuint vao, float noiseBlend = 0.0f,
+               float loopLength = 0.0f) {
+    int visible = fires.upload();
+    bool tiled = tiles && visible == 1 && fires.emitters.size() == 1;
+    int tileCount = tiled ? tiles->classify(fires.emitters[0], time, vao) : 0;
+    FrameData frame = {};
+    frame.uvOffset[0] = uvOffset[0];
+    frame.uvOffset[1] = uvOffset[1];
+    if (tiled) {
+        frame.tileSize[0] = tiles->size()[0];
+        frame.tileSize[1] = tiles->size()[1];
+    }
+    frame.time = time;
+    frame.noiseBlend = noiseBlend;
+    frame.loopLength = loopLength;
+    fires.setFrame(frame);
+    if (tiled) {
+        for (int tileClass = 1; tileClass <= 3; ++tileClass) {
+            variant.tileClass = tileClass;
+            glState.useProgram(shaders.get(variant).id);
+            fires.drawTiles(tileCount);
+        }
+        return;
+    }
+    glState.useProgram(shaders.get(variant).id);
+    fires.draw();
+}
+
+/// Загрузка цели прохода огней: огонь на весь экран пишет каждый пиксель, и очистка не нужна.
+RenderGraph::Load firePassLoad(const FireEmitters& fires) {
+    return fires.coversScreen() ? RenderGraph::Load::Overwrite : RenderGraph::Load::Clear;
+}
+
+// ---------- Spark Particles ----------
+// Искры — частицы, которые живут в двух VBO и обновляются transform feedback:
+// вершинный шейдер читает состояние из одного буфера и пишет в другой, без
+// растеризации. Стоимость растёт с числом частиц, а не пикселей.
+
+// Shared by the update and draw passes. The life of a particle is a function of
+// time alone: lifetime and phase come from its index, so pausing, looping and
+// jumps in time keep every particle consistent without extra state.
+const char* sparkLifeGLSL = GLSL_CODE(
+uint sparkHash(uint x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+float sparkRandom(uint key, uint salt) {
+    return float(sparkHash(key * 0x9e3779b9u + salt) >> 8) / 16777216.0;
+}
+
+// x = lifetime, y = age, z = birth index; a loop holds a whole number of lifetimes,
+// and the birth index wraps with it
+vec3 sparkLife(uint id, float time, float loopLength) {
+    float lifetime = mix(0.6, 1.6, sparkRandom(id, 0u));
+    float cycles = 0.0;
+    if (loopLength > 0.0) {
+        cycles = max(1.0, floor(loopLength / lifetime + 0.5));
+        lifetime = loopLength / cycles;
+    }
+    float phase = sparkRandom(id, 1u) * lifetime;
+    float births = floor((time - phase) / lifetime);
+    float age = time - phase - births * lifetime;
+    return vec3(lifetime, age, cycles > 0.0 ? mod(births, cycles) : births);
+}
+);
+
+const char* sparkUpdateVertexSrc = GLSL_CODE(
+layout(location = 0) in vec4 state;     // position.xy, velocity.xy in the emitter's [-1, 1] quad
+layout(location = 1) in vec2 life;      // birth index, emitter
+out vec4 outState;
+out vec2 outLife;
+uniform sampler3D noiseTex;
+uniform samplerBuffer emitters;         // FireEmitters instances: rect, params
+uniform int emitterCount;
+uniform float time;
+uniform float dt;
+uniform float loopLength;
+
+float sparkNoise(vec3 p) { return ANALYTIC_NOISE != 0 ? hashNoise(p) : texture(noiseTex, p).r; }
+
+void main() {
+    uint id = uint(gl_VertexID);
+    vec3 l = sparkLife(id, time, loopLength);
+    outState = state;
+    outLife = life;
+    if (l.z != life.x) {
+        // A new life at the base of a random emitter
+        uint key = sparkHash(id ^ sparkHash(uint(int(l.z))));
+        outLife = vec2(l.z, floor(sparkRandom(key, 2u) * float(emitterCount)));
+        outState.xy = vec2(sparkRandom(key, 3u) * 2.0 - 1.0, -1.0 + 0.4 * sparkRandom(key, 4u));
+        outState.zw = vec2(sparkRandom(key, 5u) - 0.5, mix(0.6, 1.4, sparkRandom(key, 6u)));
+        // A particle born between two updates (or before the first) has already flown for its age
+        if (outLife.y < float(emitterCount))
+            outState.xy += outState.zw * l.y * texelFetch(emitters, int(outLife.y) * 2 + 1).y;
+        return;
+    }
+    if (life.y >= float(emitterCount)) return;
+
+    // Advected by the fire's own noise field, at the emitter's speed and scroll
+    vec4 params = texelFetch(emitters, int(life.y) * 2 + 1);
+    float period = loopLength * params.y * 0.2;
+    float scroll = loopLength > 0.0 ? max(1.0, floor(period + 0.5)) / period : 1.0;
+    vec2 uv = state.xy * 0.5 + 0.7 + vec2(params.x, 0.0);
+    float t = time * params.y * 0.2 * scroll;
+    vec3 p = vec3(uv.x * 3.0, uv.y * 5.0 + t, t);
+    vec2 turbulence = vec2(sparkNoise(p), sparkNoise(p + vec3(0.5, 0.0, 0.25))) - 0.5;
+    float step = dt * params.y;
+    outState.zw += (turbulence * vec2(12.0, 4.0) + vec2(0.0, 0.8)) * step;
+    outState.zw *= max(1.0 - step, 0.0);
+    outState.xy += outState.zw * step;
+}
+);
+
+const char* sparkDrawVertexSrc = GLSL_CODE(
+layout(location = 0) in vec4 state;
+layout(location = 1) in vec2 life;
+out float intensity;
+uniform samplerBuffer emitters;
+uniform int emitterCount;
+uniform float time;
+uniform float loopLength;
+uniform float pointSize;                // pixels for a fullscreen emitter
+
+void main() {
+    vec3 l = sparkLife(uint(gl_VertexID), time, loopLength);
+    if (life.y >= float(emitterCount)) {
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        gl_PointSize = 1.0;
+        intensity = 0.0;
+        return;
+    }
+    vec4 rect = texelFetch(emitters, int(life.y) * 2);
+    float fade = 1.0 - l.y / l.x;
+    float flicker = 0.6 + 0.4 * sin(l.y * 40.0 + float(gl_VertexID));
+    // Sparks cool down as they rise, like the old mask over the lower half
+    intensity = fade * fade * flicker * (1.0 - smoothstep(0.0, 1.2, state.y + 1.0));
+    gl_Position = vec4(rect.xy + state.xy * rect.zw, 0.0, 1.0);
+    gl_PointSize = max(pointSize * rect.w * (0.5 + 0.5 * fade), 1.0);
+}
+);
+
+const char* sparkDrawFragmentSrc = GLSL(
+out vec4 FragColor;
+in float intensity;
+void main() {
+    vec2 d = gl_PointCoord * 2.0 - 1.0;
+    float falloff = max(1.0 - dot(d, d), 0.0);
+    FragColor = vec4(vec3(1.0, 0.8, 0.3) * intensity * falloff * 1.5, 1.0);
+}
+);
+
+/**
+ * @brief Искры как GPU-частицы (transform feedback, GL 3.3).
+ *
+ * Состояние частиц — два VBO, которые меняются ролями каждый кадр. update()
+ * продвигает частицы: рождает новые у основания случайного видимого огня и
+ * сносит живые тем же шумом, что и пламя (noiseTex или hashNoise()). draw()
+ * рисует их аддитивными point sprite поверх огня. Данные огней читаются из
+ * буфера экземпляров FireEmitters как texture buffer.
+ */
+class SparkParticles {
+public:
+    static const int defaultCount = 2048;
+
+    /// @param analyticNoise — период решётки hashNoise() (ShaderVariant::analyticNoise), 0 — читать noiseTex
+    SparkParticles(int count, const FireEmitters& fires, int analyticNoise = 0) : count(count) {
+        std::string header = "#version 330 core\n";
+        std::string updateVs = header + "#define ANALYTIC_NOISE " + std::to_string(analyticNoise) + "\n" +
+                               analyticNoiseGLSL + sparkLifeGLSL + sparkUpdateVertexSrc;
+        std::string drawVs = header + sparkLifeGLSL + sparkDrawVertexSrc;
+        updateProgram = glCreateProgram();
+        GLuint vs = compileShader(GL_VERTEX_SHADER, updateVs.c_str());
+        glAttachShader(updateProgram, vs);
+        const char* varyings[] = { "outState", "outLife" };
+        glTransformFeedbackVaryings(updateProgram, 2, varyings, GL_INTERLEAVED_ATTRIBS);
+        glLinkProgram(updateProgram);
+        glDeleteShader(vs);
+        GLint linked = 0;
+        glGetProgramiv(updateProgram, GL_LINK_STATUS, &linked);
+        if (!linked)
+            std::cerr << "Spark update link error:\n" << programInfoLog(updateProgram) << std::endl;
+        drawProgram = linkProgram({ compileShader(GL_VERTEX_SHADER, drawVs.c_str()),
+                                    compileShader(GL_FRAGMENT_SHADER, sparkDrawFragmentSrc) });
+
+        glState.useProgram(updateProgram);
+        glUniform1i(glGetUniformLocation(updateProgram, "noiseTex"), 0);
+        glUniform1i(glGetUniformLocation(updateProgram, "emitters"), 6);
+        updateLocs = { glGetUniformLocation(updateProgram, "emitterCount"), glGetUniformLocation(updateProgram, "time"),
+                       glGetUniformLocation(updateProgram, "loopLength") };
+        dtLoc = glGetUniformLocation(updateProgram, "dt");
+        glState.useProgram(drawProgram);
+        glUniform1i(glGetUniformLocation(drawProgram, "emitters"), 6);
+        drawLocs = { glGetUniformLocation(drawProgram, "emitterCount"), glGetUniformLocation(drawProgram, "time"),
+                     glGetUniformLocation(drawProgram, "loopLength") };
+        pointSizeLoc = glGetUniformLocation(drawProgram, "pointSize");
+
+        // Every particle starts with an impossible birth index, so the first update spawns it
+        std::vector<float> initial((size_t)count * floatsPerParticle, 0.0f);
+        for (int i = 0; i < count; ++i)
+            initial[(size_t)i * floatsPerParticle + 4] = -1.0e9f;
+        glGenBuffers(2, buffers);
+        glGenVertexArrays(2, vaos);
+        for (int i = 0; i < 2; ++i) {
+            glState.bindVertexArray(vaos[i]);
+            glBindBuffer(GL_ARRAY_BUFFER, buffers[i]);
+            glBufferData(GL_ARRAY_BUFFER, initial.size() * sizeof(float), initial.data(), GL_DYNAMIC_COPY);
+            GLsizei stride = floatsPerParticle * sizeof(float);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, stride, (void*)0);
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void*)(4 * sizeof(float)));
+        }
+        glState.bindVertexArray(0);
+
+        glGenTextures(1, &emitterTexture);
+        glState.bindTexture(GL_TEXTURE_BUFFER, emitterTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, fires.instanceBuffer());
+        glState.bindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+
+    ~SparkParticles() {
+        glState.deleteTextures(1, &emitterTexture);
+        glState.deleteVertexArrays(2, vaos);
+        glDeleteBuffers(2, buffers);
+        glState.deleteProgram(updateProgram);
+        glState.deleteProgram(drawProgram);
+    }
+
+    SparkParticles(const SparkParticles&) = delete;
+    SparkParticles& operator=(const SparkParticles&) = delete;
+
+    /**
+     * @brief Продвигает частицы к времени time (то же, что в drawFires).
+     *
+     * Предполагает noiseTex на юните 0 и уже выполненный FireEmitters::upload().
+     * @param dt — шаг с прошлого кадра; 0 на паузе
+     */
+    void update(const FireEmitters& fires, float time, float dt, float loopLength = 0.0f) {
+        int emitterCount = fires.visibleCount();
+        if (emitterCount == 0) return;
+        glState.useProgram(updateProgram);
+        setCommon(updateLocs, emitterCount, time, loopLength);
+        glUniform1f(dtLoc, std::min(std::max(dt, 0.0f), 0.1f));
+
+        glEnable(GL_RASTERIZER_DISCARD);
+        glState.bindVertexArray(vaos[current]);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, buffers[current ^ 1]);
+        glBeginTransformFeedback(GL_POINTS);
+        glDrawArrays(GL_POINTS, 0, count);
+        glEndTransformFeedback();
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+        glDisable(GL_RASTERIZER_DISCARD);
+        current ^= 1;
+    }
+
+    /// Рисует частицы аддитивно в текущий framebuffer высотой viewportHeight пикселей.
+    void draw(const FireEmitters& fires, float time, int viewportHeight, float loopLength = 0.0f) {
+        int emitterCount = fires.visibleCount();
+        if (emitterCount == 0) return;
+        glState.useProgram(drawProgram);
+        setCommon(drawLocs, emitterCount, time, loopLength);
+        glUniform1f(pointSizeLoc, std::max(2.0f, viewportHeight / 150.0f));
+
+        glEnable(GL_PROGRAM_POINT_SIZE);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE);
+        glState.bindVertexArray(vaos[current]);
+        glDrawArrays(GL_POINTS, 0, count);
+        glDisable(GL_BLEND);
+        glDisable(GL_PROGRAM_POINT_SIZE);
+    }
+
+private:
+    static const int floatsPerParticle = 6;
+
+    struct CommonLocs { int emitterCount, time, loopLength; };
+
+    void setCommon(const CommonLocs& locs, int emitterCount, float time, float loopLength) {
+        glUniform1i(locs.emitterCount, emitterCount);
+        glUniform1f(locs.time, time);
+        glUniform1f(locs.loopLength, loopLength);
+        glState.activeTexture(GL_TEXTURE6);
+        glState.bindTexture(GL_TEXTURE_BUFFER, emitterTexture);
+        glState.activeTexture(GL_TEXTURE0);
+    }
+
+    int count;
+    GLuint updateProgram = 0, drawProgram = 0;
+    CommonLocs updateLocs{}, drawLocs{};
+    int dtLoc = -1, pointSizeLoc = -1;
+    GLuint buffers[2] = { 0, 0 };
+    GLuint vaos[2] = { 0, 0 };
+    GLuint emitterTexture = 0;
+    int current = 0;
+};
+
+// ---------- Loop Playback ----------
+// Crossfade between two neighbouring frames of the cached cycle
+const char* loopPlaybackFragmentSrc = GLSL(
+out vec4 FragColor;
+uniform sampler2DArray frames;
+uniform float layer;        // position in the cycle, in frames
+void main() {
+    int count = textureSize(frames, 0).z;
+    int first = int(layer);
+    ivec2 c = ivec2(gl_FragCoord.xy);
+    vec4 a = texelFetch(frames, ivec3(c, first), 0);
+    vec4 b = texelFetch(frames, ivec3(c, (first + 1) % count), 0);
+    FragColor = mix(a, b, layer - float(first));
+}
+);
+
+/**
+ * @brief Кэш одного цикла анимации (--loop-cache).
+ *
+ * С LOOP анимация строго периодична, поэтому цикл рендерится один раз в
+ * массив текстур RGBA8, а дальше кадр — это смешивание двух соседних слоёв,
+ * почти бесплатное для GPU. Слоёв loopSeconds * fps, но не больше, чем
+ * помещается в maxBytes. Запись повторяется при смене размера окна, варианта
+ * шейдера или программ (см. ShaderCache::sourceGeneration).
+ */
+class LoopCache {
+public:
+    static constexpr size_t maxBytes = size_t(256) << 20;
+
+    LoopCache(float loopSeconds, float fps) : loopSeconds(loopSeconds), fps(fps) {
+        program = linkProgram({ compileShader(GL_VERTEX_SHADER, fullscreenVertexSrc),
+                                compileShader(GL_FRAGMENT_SHADER, loopPlaybackFragmentSrc) });
+        glState.useProgram(program);
+        glUniform1i(glGetUniformLocation(program, "frames"), 2);
+        layerLoc = glGetUniformLocation(program, "layer");
+        glGenTextures(1, &frames);
+        glGenFramebuffers(1, &fbo);
+    }
+
+    ~LoopCache() {
+        glDeleteFramebuffers(1, &fbo);
+        glState.deleteTextures(1, &frames);
+        glState.deleteProgram(program);
+    }
+
+    LoopCache(const LoopCache&) = delete;
+    LoopCache& operator=(const LoopCache&) = delete;
+
+    /// Записан ли цикл для этого ключа и размера.
+    bool valid(uint64_t key, int w, int h) const {
+        return recorded && key == recordedKey && w == width && h == height;
+    }
+
+    /// Сбрасывает кэш, например после замены текстуры шума.
+    void invalidate() { recorded = false; }
+
+    /**
+     * @brief Рендерит весь цикл в слои.
+     *
+     * @param render — render(time, fbo) рисует кадр со временем time в [0, loopSeconds) в fbo
+     */
+    template <typename RenderFn>
+    void record(uint64_t key, int w, int h, RenderFn&& render) {
+        double start = glfwGetTime();
+        size_t frameBytes = (size_t)w * h * 4;
+        GLint maxLayers = 0;
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+        int count = std::max(2, (int)std::lround(loopSeconds * fps));
+        count = std::min(count, (int)std::max(size_t(2), maxBytes / frameBytes));
+        count = std::min(count, (int)maxLayers);
+        if (w != width || h != height || count != layers) {
+            width = w;
+            height = h;
+            layers = count;
+            glState.bindTexture(GL_TEXTURE_2D_ARRAY, frames);
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, w, h, count, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        }
+
+        for (int i = 0; i < layers; ++i) {
+            // render() may draw through the post-processing buffers first
+            glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, frames, 0, i);
+            render(loopSeconds * i / layers, fbo);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        recorded = true;
+        recordedKey = key;
+        std::cout << "Loop cache: " << layers << " frames " << w << "x" << h << ", "
+                  << (frameBytes * layers >> 20) << " MB, " << int((glfwGetTime() - start) * 1000.0)
+                  << " ms" << std::endl;
+    }
+
+    /// Выводит кадр цикла для time (секунды, в любом диапазоне) в текущий framebuffer.
+    void play(float time, GLuint vao) const {
+        float phase = std::fmod(time / loopSeconds, 1.0f);
+        if (phase < 0.0f) phase += 1.0f;
+        glState.useProgram(program);
+        glUniform1f(layerLoc, std::min(phase * layers, layers - 1e-3f));
+        glState.activeTexture(GL_TEXTURE2);
+        glState.bindTexture(GL_TEXTURE_2D_ARRAY, frames);
+        glState.activeTexture(GL_TEXTURE0);
+        drawFullscreenTriangle(vao);
+    }
+
+private:
+    float loopSeconds, fps;
+    GLuint program = 0;
+    int layerLoc = -1;
+    GLuint frames = 0, fbo = 0;
+    int width = 0, height = 0, layers = 0;
+    bool recorded = false;
+    uint64_t recordedKey = 0;
+};
+
+// ---------- Volumetric Fire ----------
+// Режим --volume: вместо плоской проекции — столб огня в мировых координатах,
+// который можно облетать камерой. Плотность берётся из того же noiseTex,
+// а пустое пространство пропускается по грубой сетке min/max блоков объёма.
+
+// One texel per brick: min / max of noiseTex over the brick and a one-texel
+// border, since trilinear samples near a brick face also read the neighbour
+const char* brickBakeFragmentSrc = GLSL(
+out vec2 range;
+uniform sampler3D noiseTex;
+uniform int slice;
+uniform int brickSize;
+void main() {
+    ivec3 size = textureSize(noiseTex, 0);
+    ivec3 origin = ivec3(ivec2(gl_FragCoord.xy), slice) * brickSize;
+    float lo = 1.0;
+    float hi = 0.0;
+    for (int z = -1; z <= brickSize; ++z) {
+        for (int y = -1; y <= brickSize; ++y) {
+            for (int x = -1; x <= brickSize; ++x) {
+                ivec3 c = (origin + ivec3(x, y, z) + size) % size;
+                float v = texelFetch(noiseTex, c, 0).r;
+                lo = min(lo, v);
+                hi = max(hi, v);
+            }
+        }
+    }
+    range = vec2(lo, hi);
+}
+);
+
+const char* volumeFragmentSrc = GLSL(
+out vec4 FragColor;
+uniform sampler3D noiseTex;
+uniform sampler3D bricks;           // min / max of noiseTex per brick; mips 1 and 2 merge 2³ and 4³ bricks
+uniform sampler2D history;          // previous accumulated frame
+uniform vec2 outputSize;
+uniform mat3 cameraBasis;           // right, up, forward
+uniform vec3 cameraPos;
+uniform float tanHalfFov;
+uniform float time;
+uniform float brickScale;           // bricks per period of the volume
+uniform float frameJitter;          // offset of the first step, in steps
+uniform float historyWeight;        // 0 = no usable history
+uniform int colorScheme;
+uniform int maxSteps;
+
+// The column is a cylinder of `radius` between y = 0 and y = `height`
+const float radius = 0.7;
+const float height = 2.2;
+const float stepSize = height / 128.0;
+const float scale = 0.5;            // volume periods per world unit
+// Offsets of the upper octaves, in whole cells of brick mips 1 and 2 for any
+// power-of-two brick count, so that a brick maps onto exactly one coarse cell
+const vec3 octave2 = vec3(0.5, 0.5, 0.0);
+const vec3 octave3 = vec3(0.0, 0.5, 0.5);
+
+vec3 getFireColor(float fire) {
+    if (colorScheme == 1) {
+        return mix(vec3(0.8, 0.1, 0.0), vec3(1.0, 0.4, 0.0), fire * 2.0);
+    }
+    else if (colorScheme == 2) {
+        return mix(vec3(0.0, 0.2, 0.8), vec3(0.2, 0.8, 1.0), fire * 2.0);
+    }
+    else {
+        return mix(vec3(1.0, 0.4, 0.0), vec3(1.0, 1.0, 0.2), fire * 2.0);
+    }
+}
+
+// The flame rises through the tiling volume
+vec3 flowCoord(vec3 p) {
+    return p * scale + vec3(0.0, -time * 0.25, time * 0.05);
+}
+
+// Three octaves as in fbm(). Level 0 only: a coarser mip averages texels outside the brick
+float flameNoise(vec3 q) {
+    return 0.6 * textureLod(noiseTex, q, 0.0).r
+         + 0.25 * textureLod(noiseTex, q * 2.0 + octave2, 0.0).r
+         + 0.15 * textureLod(noiseTex, q * 4.0 + octave3, 0.0).r;
+}
+
+// Upper bound of flameNoise() over the brick `cell`
+float flameBound(ivec3 cell) {
+    ivec3 size1 = textureSize(bricks, 1);
+    ivec3 size2 = textureSize(bricks, 2);
+    return 0.6 * texelFetch(bricks, cell, 0).g
+         + 0.25 * texelFetch(bricks, (cell + ivec3(octave2 * vec3(size1))) % size1, 1).g
+         + 0.15 * texelFetch(bricks, (cell + ivec3(octave3 * vec3(size2))) % size2, 2).g;
+}
+
+// Noise level below which the column is empty; it grows towards the rim and the tip
+float cutoff(float r2, float h) {
+    return 0.3 + 0.55 * r2 / (radius * radius) + 0.3 * h;
+}
+
+// Lowest cutoff on the ray between s0 and s1: r^2 is a parabola in s, h is linear
+float minCutoff(vec3 ro, vec3 rd, float s0, float s1) {
+    float closest = clamp(-dot(ro.xz, rd.xz) / max(dot(rd.xz, rd.xz), 1e-6), s0, s1);
+    vec2 c = ro.xz + rd.xz * closest;
+    float y = ro.y + rd.y * (rd.y > 0.0 ? s0 : s1);
+    return cutoff(dot(c, c), max(y, 0.0) / height);
+}
+
+// Distance along the ray to the face of the brick that contains q
+float brickExit(vec3 q, vec3 dq) {
+    vec3 b = q * brickScale;
+    vec3 face = floor(b) + step(vec3(0.0), dq);
+    vec3 dist = abs(face - b) / max(abs(dq) * brickScale, vec3(1e-6));
+    return min(min(dist.x, dist.y), dist.z);
+}
+
+void main() {
+    vec2 ndc = gl_FragCoord.xy / outputSize * 2.0 - 1.0;
+    vec3 rd = normalize(cameraBasis * vec3(ndc.x * tanHalfFov * outputSize.x / outputSize.y, ndc.y * tanHalfFov, 1.0));
+    vec3 ro = cameraPos;
+
+    // Analytic bounds of the cylinder
+    float a = dot(rd.xz, rd.xz);
+    float b = dot(ro.xz, rd.xz);
+    float disc = b * b - a * (dot(ro.xz, ro.xz) - radius * radius);
+    float near = 0.0;
+    float far = -1.0;
+    if (disc > 0.0 && a > 1e-6) {
+        float root = sqrt(disc);
+        vec2 slab = (vec2(0.0, height) - ro.y) / (abs(rd.y) > 1e-6 ? rd.y : 1e-6);
+        near = max(max((-b - root) / a, min(slab.x, slab.y)), 0.0);
+        far = min((-b + root) / a, max(slab.x, slab.y));
+    }
+
+    // Interleaved gradient noise decorrelates neighbouring pixels, frameJitter the frames;
+    // the history averages the banding of the fixed step away
+    float jitter = fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))) + frameJitter);
+    vec3 dq = rd * scale;
+    float s = near + jitter * stepSize;
+    vec3 color = vec3(0.0);
+    float transmittance = 1.0;
+    for (int i = 0; i < maxSteps && s < far; ++i) {
+        vec3 p = ro + rd * s;
+        vec3 q = flowCoord(p);
+        // Empty-space skipping: no point of this brick can exceed the cutoff
+        float skip = brickExit(q, dq);
+        ivec3 cell = min(ivec3(fract(q) * brickScale), textureSize(bricks, 0) - 1);
+        if (flameBound(cell) < minCutoff(ro, rd, s, s + skip)) {
+            s += skip + 1e-4;
+            continue;
+        }
+        float h = p.y / height;
+        float density = flameNoise(q) - cutoff(dot(p.xz, p.xz), h);
+        if (density > 0.0) {
+            float heat = clamp(density * 4.0 * (1.0 - 0.6 * h), 0.0, 1.0);
+            float alpha = 1.0 - exp(-density * 40.0 * stepSize);
+            color += transmittance * alpha * getFireColor(heat * 0.5) * heat * 3.0;
+            transmittance *= 1.0 - alpha;
+            // Early ray termination: nothing behind this point is visible any more
+            if (transmittance < 0.01) break;
+        }
+        s += stepSize;
+    }
+
+    vec3 previous = texelFetch(history, ivec2(gl_FragCoord.xy), 0).rgb;
+    FragColor = vec4(mix(color, previous, historyWeight), 1.0);
+}
+);
+
+/// Орбитальная камера режима --volume; смотрит на середину столба огня.
+struct OrbitCamera {
+    float yaw = 0.5f;
+    float pitch = 0.2f;
+    float distance = 4.5f;
+
+    void rotate(float dYaw, float dPitch) {
+        yaw += dYaw;
+        pitch = std::min(std::max(pitch + dPitch, -1.2f), 1.4f);
+    }
+
+    void zoom(float factor) { distance = std::min(std::max(distance * factor, 1.5f), 12.0f); }
+
+    bool operator!=(const OrbitCamera& other) const {
+        return yaw != other.yaw || pitch != other.pitch || distance != other.distance;
+    }
+};
+
+/**
+ * @brief Объёмный огонь (--volume): raymarching столба огня по noiseTex.
+ *
+ * setNoise() строит по объёму шума сетку блоков 8³ с min/max значений и два
+ * её mip-уровня для верхних октав; луч перескакивает блоки, где плотность не
+ * может превысить порог. Марш
+ * обрывается, когда пропускание падает ниже 1%, и ограничен maxSteps шагами.
+ * Начало луча сдвигается на случайную долю шага, разную в каждом кадре,
+ * а история пинг-понг накапливает результат, пока камера стоит.
+ */
+class VolumeFire {
+public:
+    static const int brickSize = 8;
+    static const int maxSteps = 192;
+    /// Доля истории в итоговом пикселе, при неподвижной камере и во время её движения.
+    static constexpr float historyWeight = 0.6f;
+    static constexpr float movingHistoryWeight = 0.2f;
+    static constexpr float fovY = 0.8f;
+
+    VolumeFire() {
+        brickProgram = linkProgram({ compileShader(GL_VERTEX_SHADER, fullscreenVertexSrc),
+                                     compileShader(GL_FRAGMENT_SHADER, brickBakeFragmentSrc) });
+        glState.useProgram(brickProgram);
+        glUniform1i(glGetUniformLocation(brickProgram, "noiseTex"), 0);
+        glUniform1i(glGetUniformLocation(brickProgram, "brickSize"), brickSize);
+        sliceLoc = glGetUniformLocation(brickProgram, "slice");
+
+        program = linkProgram({ compileShader(GL_VERTEX_SHADER, fullscreenVertexSrc),
+                                compileShader(GL_FRAGMENT_SHADER, volumeFragmentSrc) });
+        glState.useProgram(program);
+        glUniform1i(glGetUniformLocation(program, "noiseTex"), 0);
+        glUniform1i(glGetUniformLocation(program, "history"), 3);
+        glUniform1i(glGetUniformLocation(program, "bricks"), 7);
+        glUniform1i(glGetUniformLocation(program, "maxSteps"), maxSteps);
+        glUniform1f(glGetUniformLocation(program, "tanHalfFov"), std::tan(fovY * 0.5f));
+        outputSizeLoc = glGetUniformLocation(program, "outputSize");
+        cameraBasisLoc = glGetUniformLocation(program, "cameraBasis");
+        cameraPosLoc = glGetUniformLocation(program, "cameraPos");
+        timeLoc = glGetUniformLocation(program, "time");
+        brickScaleLoc = glGetUniformLocation(program, "brickScale");
+        frameJitterLoc = glGetUniformLocation(program, "frameJitter");
+        historyWeightLoc = glGetUniformLocation(program, "historyWeight");
+        colorSchemeLoc = glGetUniformLocation(program, "colorScheme");
+        glGenTextures(1, &bricks);
+        glGenFramebuffers(2, fbos);
+        glGenTextures(2, textures);
+    }
+
+    ~VolumeFire() {
+        glDeleteFramebuffers(2, fbos);
+        glState.deleteTextures(2, textures);
+        glState.deleteTextures(1, &bricks);
+        glState.deleteProgram(program);
+        glState.deleteProgram(brickProgram);
+    }
+
+    VolumeFire(const VolumeFire&) = delete;
+    VolumeFire& operator=(const VolumeFire&) = delete;
+
+    /**
+     * @brief Строит сетку блоков для объёма шума.
+     *
+     * Вызывается после запекания и после каждой замены noiseTex (например,
+     * когда потоковая загрузка сменяет временный объём 32³ на полный).
+     * Размер объёма — степень двойки, иначе блоки мипов не совпадут с октавами.
+     */
+    void setNoise(GLuint noiseTex, GLuint vao) {
+        double start = glfwGetTime();
+        GLint size = 0;
+        glState.activeTexture(GL_TEXTURE0);
+        glState.bindTexture(GL_TEXTURE_3D, noiseTex);
+        glGetTexLevelParameteriv(GL_TEXTURE_3D, 0, GL_TEXTURE_WIDTH, &size);
+        int count = std::max(1, (size + brickSize - 1) / brickSize);
+        brickScale = (float)size / brickSize;
+
+        glState.bindTexture(GL_TEXTURE_3D, bricks);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_RG32F, count, count, count, 0, GL_RG, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, 2);
+        glState.bindTexture(GL_TEXTURE_3D, noiseTex);
+
+        glState.useProgram(brickProgram);
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        GLuint fbo;
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glViewport(0, 0, count, count);
+        for (int z = 0; z < count; ++z) {
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, bricks, 0, z);
+            glUniform1i(sliceLoc, z);
+            drawFullscreenTriangle(vao);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &fbo);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+        // The second and third octave sample 2x and 4x larger blocks; the mips are tiny,
+        // so they are merged on the CPU
+        std::vector<float> ranges((size_t)count * count * count * 2);
+        glState.bindTexture(GL_TEXTURE_3D, bricks);
+        glGetTexImage(GL_TEXTURE_3D, 0, GL_RG, GL_FLOAT, ranges.data());
+        int n = count;
+        for (int level = 1; level <= 2; ++level) {
+            int m = std::max(1, n / 2);
+            std::vector<float> merged((size_t)m * m * m * 2);
+            for (int z = 0; z < m; ++z) {
+                for (int y = 0; y < m; ++y) {
+                    for (int x = 0; x < m; ++x) {
+                        float lo = 1.0f, hi = 0.0f;
+                        for (int i = 0; i < 8; ++i) {
+                            int cx = std::min(2 * x + (i & 1), n - 1);
+                            int cy = std::min(2 * y + (i >> 1 & 1), n - 1);
+                            int cz = std::min(2 * z + (i >> 2), n - 1);
+                            const float* child = &ranges[(((size_t)cz * n + cy) * n + cx) * 2];
+                            lo = std::min(lo, child[0]);
+                            hi = std::max(hi, child[1]);
+                        }
+                        float* cell = &merged[(((size_t)z * m + y) * m + x) * 2];
+                        cell[0] = lo;
+                        cell[1] = hi;
+                    }
+                }
+            }
+            glTexImage3D(GL_TEXTURE_3D, level, GL_RG32F, m, m, m, 0, GL_RG, GL_FLOAT, merged.data());
+            ranges.swap(merged);
+            n = m;
+        }
+        historyValid = false;
+        std::cout << "Volume bricks: " << count << "^3 of " << brickSize << "^3 texels, "
+                  << int((glfwGetTime() - start) * 1000.0) << " ms" << std::endl;
+    }
+
+    /// Цветовая схема огня 0..2, как у варианта шейдера.
+    void setColorScheme(int scheme) {
+        glState.useProgram(program);
+        glUniform1i(colorSchemeLoc, scheme);
+        historyValid = false;
+    }
+
+    /**
+     * @brief Рисует кадр объёмного огня в target (0 — default framebuffer).
+     *
+     * noiseTex должен быть привязан к текстурному блоку 0.
+     */
+    void draw(const OrbitCamera& camera, float time, int outputWidth, int outputHeight, GLuint vao, GLuint target = 0) {
+        if (outputWidth != width || outputHeight != height)
+            resize(outputWidth, outputHeight);
+        bool moved = camera != lastCamera;
+        lastCamera = camera;
+
+        // Orbit around the middle of the column; basis columns are right, up, forward
+        const float center[3] = { 0.0f, 1.1f, 0.0f };
+        float cp = std::cos(camera.pitch), sp = std::sin(camera.pitch);
+        float offset[3] = { cp * std::sin(camera.yaw), sp, cp * std::cos(camera.yaw) };
+        float position[3] = { center[0] + camera.distance * offset[0], center[1] + camera.distance * offset[1],
+                              center[2] + camera.distance * offset[2] };
+        float rightLength = std::sqrt(offset[0] * offset[0] + offset[2] * offset[2]);
+        float basis[9] = {
+            offset[2] / rightLength, 0.0f, -offset[0] / rightLength,
+            -sp * offset[0] / rightLength, cp, -sp * offset[2] / rightLength,
+            -offset[0], -offset[1], -offset[2]
+        };
+
+        int write = historyIndex, read = 1 - historyIndex;
+        glBindFramebuffer(GL_FRAMEBUFFER, fbos[write]);
+        glViewport(0, 0, width, height);
+        glState.useProgram(program);
+        glState.activeTexture(GL_TEXTURE3);
+        glState.bindTexture(GL_TEXTURE_2D, textures[read]);
+        glState.activeTexture(GL_TEXTURE7);
+        glState.bindTexture(GL_TEXTURE_3D, bricks);
+        glState.activeTexture(GL_TEXTURE0);
+        glUniform2f(outputSizeLoc, (float)width, (float)height);
+        glUniformMatrix3fv(cameraBasisLoc, 1, GL_FALSE, basis);
+        glUniform3fv(cameraPosLoc, 1, position);
+        glUniform1f(timeLoc, time);
+        glUniform1f(brickScaleLoc, brickScale);
+        // Golden-ratio sequence: consecutive frames cover the step evenly
+        glUniform1f(frameJitterLoc, (float)std::fmod(frame++ * 0.6180339887, 1.0));
+        glUniform1f(historyWeightLoc, !historyValid ? 0.0f : moved ? movingHistoryWeight : historyWeight);
+        drawFullscreenTriangle(vao);
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, fbos[write]);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, target);
+        historyIndex ^= 1;
+        historyValid = true;
+    }
+
+private:
+    void resize(int w, int h) {
+        width = w;
+        height = h;
+        for (int i = 0; i < 2; ++i) {
+            glState.bindTexture(GL_TEXTURE_2D, textures[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glBindFramebuffer(GL_FRAMEBUFFER, fbos[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[i], 0);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        historyValid = false;
+    }
+
+    GLuint brickProgram = 0, program = 0;
+    int sliceLoc;
+    int outputSizeLoc, cameraBasisLoc, cameraPosLoc, timeLoc, brickScaleLoc;
+    int frameJitterLoc, historyWeightLoc, colorSchemeLoc;
+    GLuint bricks = 0;
+    float brickScale = 1.0f;
+    GLuint fbos[2];
+    GLuint textures[2];
+    int width = 0, height = 0;
+    int frame = 0;
+    int historyIndex = 0;
+    bool historyValid = false;
+    OrbitCamera lastCamera;
+};
+
+// ---------- Frame Profiler ----------
+
+/// Тайминги одного кадра; -1 — значение ещё (или уже) неизвестно.
+struct FrameSample {
+    double cpuMs = -1.0;        // from frame start to just before the swap
+    double gpuMs = -1.0;        // GL_TIME_ELAPSED of the frame's commands
+    double intervalMs = -1.0;   // from this frame's start to the next one's
+    double presentMs = -1.0;    // from this frame's start until the GPU finished it (--present-latency)
+};
+
+/// Перцентиль p (0..100) по ближайшему рангу.
+double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0.0;
+    size_t rank = (size_t)std::ceil(p / 100.0 * values.size());
+    rank = std::min(std::max(rank, (size_t)1), values.size()) - 1;
+    std::nth_element(values.begin(), values.begin() + rank, values.end());
+    return values[rank];
+}
+
+/// Сводка по одной метрике кадра.
+struct FrameStats {
+    size_t count = 0;
+    double mean = 0.0, p50 = 0.0, p95 = 0.0, p99 = 0.0, max = 0.0;
+};
+
+FrameStats computeFrameStats(const std::vector<double>& values) {
+    FrameStats stats;
+    stats.count = values.size();
+    if (values.empty()) return stats;
+    stats.mean = std::accumulate(values.begin(), values.end(), 0.0) / values.size();
+    stats.p50 = percentile(values, 50.0);
+    stats.p95 = percentile(values, 95.0);
+    stats.p99 = percentile(values, 99.0);
+    stats.max = *std::max_element(values.begin(), values.end());
+    return stats;
+}
+
+/**
+ * @brief Покадровые CPU- и GPU-тайминги для анализа хвостовых задержек.
+ *
+ * GPU-время меряется кольцом запросов GL_TIME_ELAPSED: результат кадра
+ * забирается через несколько кадров, когда он уже готов, поэтому
+ * профилировщик никогда не ждёт GPU. Хранит последние maxSamples кадров.
+ */
+class FrameProfiler {
+public:
+    static const int queryCount = 4;
+    static const size_t maxSamples = 60 * 60 * 10;   // ten minutes at 60 Hz
+
+    explicit FrameProfiler(double refreshHz) : refreshHz(refreshHz > 0.0 ? refreshHz : 60.0) {
+        glGenQueries(queryCount, queries);
+        for (int i = 0; i < queryCount; ++i)
+            queryFrame[i] = -1;
+    }
+
+    ~FrameProfiler() {
+        glDeleteQueries(queryCount, queries);
+    }
+
+    FrameProfiler(const FrameProfiler&) = delete;
+    FrameProfiler& operator=(const FrameProfiler&) = delete;
+
+    /// Начало кадра: забирает готовые GPU-результаты и запускает новый запрос.
+    void beginFrame() {
+        double now = glfwGetTime();
+        if (!samples.empty())
+            samples.back().intervalMs = (now - frameStart) * 1000.0;
+        frameStart = now;
+
+        for (int i = 0; i < queryCount; ++i) {
+            if (queryFrame[i] < 0) continue;
+            GLint available = 0;
+            glGetQueryObjectiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) continue;
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &ns);
+            if (FrameSample* sample = find(queryFrame[i]))
+                sample->gpuMs = ns / 1.0e6;
+            queryFrame[i] = -1;
+        }
+
+        samples.emplace_back();
+        if (samples.size() > maxSamples) {
+            samples.pop_front();
+            ++firstFrame;
+        }
+        // A slot still pending after a full ring is dropped rather than waited on
+        int slot = (int)(frameIndex % queryCount);
+        queryFrame[slot] = frameIndex;
+        glBeginQuery(GL_TIME_ELAPSED, queries[slot]);
+    }
+
+    /// Конец кадра — вызывать непосредственно перед glfwSwapBuffers.
+    void endFrame() {
+        glEndQuery(GL_TIME_ELAPSED);
+        samples.back().cpuMs = (glfwGetTime() - frameStart) * 1000.0;
+        ++frameIndex;
+    }
+
+    /// Задержка показа прошлого кадра (см. FramePacer); вызывать до beginFrame().
+    void presented(double ms) {
+        if (!samples.empty()) samples.back().presentMs = ms;
+    }
+
+    /// GPU-время последнего кадра, для которого оно уже известно (-1 — пока нет).
+    double latestGpuMs() const {
+        for (auto it = samples.rbegin(); it != samples.rend(); ++it)
+            if (it->gpuMs >= 0.0) return it->gpuMs;
+        return -1.0;
+    }
+
+    /**
+     * @brief Пишет path.csv (по кадрам) и path.json (перцентили) и печатает сводку.
+     */
+    bool dump(const std::string& path) const {
+        std::vector<double> cpu, gpu, interval, present;
+        int missedVsync = 0;
+        double vsyncMs = 1000.0 / refreshHz;
+        std::ofstream csv(path + ".csv");
+        csv << "frame,cpu_ms,gpu_ms,interval_ms,present_ms\n";
+        for (size_t i = 0; i < samples.size(); ++i) {
+            const FrameSample& s = samples[i];
+            csv << firstFrame + (long long)i << "," << s.cpuMs << "," << s.gpuMs << "," << s.intervalMs << "," << s.presentMs << "\n";
+            if (s.cpuMs >= 0.0) cpu.push_back(s.cpuMs);
+            if (s.presentMs >= 0.0) present.push_back(s.presentMs);
+            if (s.gpuMs >= 0.0) gpu.push_back(s.gpuMs);
+            if (s.intervalMs >= 0.0) {
+                interval.push_back(s.intervalMs);
+                // A frame that spans k refresh periods missed k - 1 of them
+                missedVsync += std::max(0, (int)std::lround(s.intervalMs / vsyncMs) - 1);
+            }
+        }
+
+        FrameStats cpuStats = computeFrameStats(cpu);
+        FrameStats gpuStats = computeFrameStats(gpu);
+        FrameStats intervalStats = computeFrameStats(interval);
+        FrameStats presentStats = computeFrameStats(present);
+        std::ofstream json(path + ".json");
+        auto writeStats = [&json](const char* name, const FrameStats& st, bool last) {
+            json << "  \"" << name << "\": { \"count\": " << st.count << ", \"mean\": " << st.mean
+                 << ", \"p50\": " << st.p50 << ", \"p95\": " << st.p95 << ", \"p99\": " << st.p99
+                 << ", \"max\": " << st.max << " }" << (last ? "\n" : ",\n");
+        };
+        json << "{\n"
+             << "  \"frames\": " << samples.size() << ",\n"
+             << "  \"refresh_hz\": " << refreshHz << ",\n"
+             << "  \"missed_vsync\": " << missedVsync << ",\n";
+        writeStats("cpu_ms", cpuStats, false);
+        writeStats("gpu_ms", gpuStats, false);
+        writeStats("interval_ms", intervalStats, present.empty());
+        if (!present.empty())
+            writeStats("present_ms", presentStats, true);
+        json << "}\n";
+
+        if (!csv.good() || !json.good()) {
+            std::cerr << "Frame profile: failed to write " << path << ".csv/.json" << std::endl;
+            return false;
+        }
+        std::cout << "Frame profile: " << samples.size() << " frames, interval p50/p95/p99 "
+                  << intervalStats.p50 << " / " << intervalStats.p95 << " / " << intervalStats.p99
+                  << " ms, GPU p99 " << gpuStats.p99 << " ms, ";
+        if (!present.empty())
+            std::cout << "present p50/p99 " << presentStats.p50 << " / " << presentStats.p99 << " ms, ";
+        std::cout << "missed vsync " << missedVsync << " -> " << path << ".csv/.json" << std::endl;
+        return true;
+    }
+
+private:
+    FrameSample* find(long long frame) {
+        if (frame < firstFrame || frame >= firstFrame + (long long)samples.size()) return nullptr;
+        return &samples[(size_t)(frame - firstFrame)];
+    }
+
+    double refreshHz;
+    GLuint queries[queryCount];
+    long long queryFrame[queryCount];   // frame measured by each query, -1 = idle
+    std::deque<FrameSample> samples;
+    long long firstFrame = 0;           // frame index of samples.front()
+    long long frameIndex = 0;
+    double frameStart = 0.0;
+};
+
+// ---------- Frame Pacing ----------
+// Режим показа кадров задаётся явно: без glfwSwapInterval поведение зависит
+// от драйвера, и несинхронизированный цикл грузит GPU на 100%.
+
+enum class PresentMode { VSync, Adaptive, Uncapped, Limited };
+
+const char* presentModeName(PresentMode mode) {
+    switch (mode) {
+    case PresentMode::Adaptive: return "adaptive";
+    case PresentMode::Uncapped: return "uncapped";
+    case PresentMode::Limited:  return "limit";
+    default:                    return "vsync";
+    }
+}
+
+bool parsePresentMode(const std::string& name, PresentMode& mode) {
+    for (PresentMode m : { PresentMode::VSync, PresentMode::Adaptive, PresentMode::Uncapped, PresentMode::Limited }) {
+        if (name == presentModeName(m)) {
+            mode = m;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Сон с точностью лучше миллисекунды.
+ *
+ * Windows 10 1803+ даёт таймер высокого разрешения; на старых системах
+ * Sleep округляет до кванта планировщика, что добирает спин-ожидание в FramePacer.
+ */
+void preciseSleep(double seconds) {
+    if (seconds <= 0.0) return;
+#ifdef _WIN32
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+    static HANDLE timer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (timer) {
+        LARGE_INTEGER due;
+        due.QuadPart = -(LONGLONG)(seconds * 1.0e7);   // relative, in 100 ns units
+        if (SetWaitableTimer(timer, &due, 0, nullptr, nullptr, FALSE)) {
+            WaitForSingleObject(timer, INFINITE);
+            return;
+        }
+    }
+    Sleep((DWORD)(seconds * 1000.0));
+#else
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+#endif
+}
+
+/**
+ * @brief Темп кадров: интервал обмена буферов, ограничитель и замер задержки показа.
+ *
+ * beginFrame() вызывается до опроса ввода: ограничитель ждёт дедлайна там,
+ * а не после рендера, поэтому ввод читается непосредственно перед кадром.
+ * С measureLatency после обмена буферов ставится fence (GL_ARB_sync, ядро 3.2),
+ * и следующий кадр ждёт его: задержка — от начала кадра до завершения его
+ * команд на GPU, включая показ, а в очереди драйвера никогда не больше одного кадра.
+ */
+class FramePacer {
+public:
+    /// Последнюю часть ожидания ограничитель крутится, а не спит.
+    static constexpr double spinSeconds = 0.001;
+    static constexpr double fenceTimeoutSeconds = 0.1;
+
+    FramePacer(PresentMode mode, double fpsLimit, bool measureLatency)
+        : presentMode(mode), measureLatency(measureLatency) {
+        // Tear only when a frame is late; needs WGL/GLX_EXT_swap_control_tear
+        if (presentMode == PresentMode::Adaptive && !glfwExtensionSupported("WGL_EXT_swap_control_tear") &&
+            !glfwExtensionSupported("GLX_EXT_swap_control_tear")) {
+            std::cerr << "Adaptive vsync is not supported, using vsync" << std::endl;
+            presentMode = PresentMode::VSync;
+        }
+        int interval = presentMode == PresentMode::VSync ? 1 : presentMode == PresentMode::Adaptive ? -1 : 0;
+        glfwSwapInterval(interval);
+        if (presentMode == PresentMode::Limited)
+            period = 1.0 / std::max(fpsLimit, 1.0);
+        deadline = glfwGetTime();
+        std::cout << "Present mode: " << presentModeName(presentMode);
+        if (presentMode == PresentMode::Limited)
+            std::cout << ", " << 1.0 / period << " fps";
+        if (measureLatency)
+            std::cout << ", present latency via fences";
+        std::cout << std::endl;
+    }
+
+    ~FramePacer() {
+        if (fence) glDeleteSync(fence);
+    }
+
+    FramePacer(const FramePacer&) = delete;
+    FramePacer& operator=(const FramePacer&) = delete;
+
+    PresentMode mode() const { return presentMode; }
+
+    /**
+     * @brief Ждёт завершения прошлого кадра и дедлайна ограничителя.
+     *
+     * @return задержка показа прошлого кадра в мс (-1 — не измерялась)
+     */
+    double beginFrame() {
+        double latencyMs = -1.0;
+        if (fence) {
+            GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, (GLuint64)(fenceTimeoutSeconds * 1.0e9));
+            if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+                latencyMs = (glfwGetTime() - frameStart) * 1000.0;
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+        if (period > 0.0) {
+            // A late frame moves the schedule instead of being followed by a burst
+            deadline = std::max(deadline + period, glfwGetTime() - period);
+            preciseSleep(deadline - glfwGetTime() - spinSeconds);
+            while (glfwGetTime() < deadline)
+                std::this_thread::yield();
+        }
+        frameStart = glfwGetTime();
+        return latencyMs;
+    }
+
+    /// Вызывать сразу после glfwSwapBuffers.
+    void endFrame() {
+        if (measureLatency)
+            fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+private:
+    PresentMode presentMode;
+    bool measureLatency;
+    double period = 0.0;        // 0 = no limiter
+    double deadline = 0.0;
+    double frameStart = 0.0;
+    GLsync fence = nullptr;
+};
+
+// ---------- Options ----------
+/**
+ * @brief Параметры запуска из командной строки.
+ *
+ *   --bake=auto|cpu|gpu — где запекать объём шума (auto = GPU, если доступен)
+ *   --noise-format=r32f|r16f|r8|bc4 — формат объёма шума в видеопамяти
+ *   --noise-report — сравнить все форматы с float-эталоном и напечатать отчёт
+ *   --no-tiling — классический объём с GL_CLAMP_TO_EDGE без mip-уровней
+ *   --noise-4d — анимированный 4D-шум: кольцо тонких срезов по времени вместо объёма 256³
+ *   --noise-source=auto|texture|analytic — шум из объёма или hashNoise() прямо в шейдере
+ *                                          (auto — по результату --bench для этого GPU)
+ *   --loop=SECONDS — строго периодическая анимация с циклом SECONDS (нужен тайлящийся объём)
+ *   --loop-cache[=FPS] — один раз отрендерить цикл в массив текстур и проигрывать его
+ *   --cache-dir=PATH — каталог кэша запечённых объёмов (по умолчанию noise_cache)
+ *   --no-cache — не читать и не писать кэш
+ *   --profile[=PATH] — при выходе записать тайминги кадров в PATH.csv/.json
+ *                      (PATH по умолчанию frame_profile; клавиша P пишет туда же)
+ *   --fbm-volume — запечь FBM-объём и читать его вместо шести октав (клавиша F — A/B)
+ *   --shader-dir=PATH — откуда читать shader.vert/shader.frag с горячей перезагрузкой
+ *                       (по умолчанию src; пусто — только встроенные шейдеры)
+ *   --shader=full|lite — набор эффектов шейдера (lite — для слабых GPU)
+ *   --octaves=N, --no-sparks, --no-distortion — отдельные переключатели шейдера
+ *   --spark-count=N — число частиц-искр (0 — без искр)
+ *   --blur-radius=PX — радиус размытия и свечения в постобработке (0 или --no-blur — без неё)
+ *   --emitters=N — стена из N факелов вместо одного полноэкранного огня
+ *   --mixed-schemes — факелы получают разные цветовые схемы
+ *   --tiles — классифицировать тайлы и рисовать дым и слабый огонь упрощёнными шейдерами
+ *   --render-scale=auto|S — рендер огня в доле S разрешения с временным апскейлом
+ *                           (auto — масштаб подбирается под --target-ms)
+ *   --target-ms=MS — целевое GPU-время кадра для --render-scale=auto и --quality=auto
+ *   --quality=auto — регулятор качества: октавы, искажения, формат шума, масштаб и искры под --target-ms
+ *   --volume — объёмный столб огня (raymarching по noiseTex) с орбитальной камерой
+ *   --windows=N — N окон вывода (по одному на монитор) с общим объёмом шума и своими огнями
+ *   --window-time-offset=S — сдвиг анимации каждого следующего окна на S секунд
+ *   --present=vsync|adaptive|uncapped|limit — режим показа кадров (по умолчанию vsync)
+ *   --fps-limit=N — ограничитель кадров: сон высокого разрешения и короткий спин (--present=limit)
+ *   --present-latency — мерить задержку показа через fence и держать в очереди не больше кадра
+ *   --bench — прогнать бенчмарк в скрытом окне и выйти
+ *   --bench-frames=N — кадров на каждую комбинацию разрешения и цветовой схемы
+ *   --bench-out=PATH — куда записать JSON с результатами (по умолчанию bench_results.json)
+ *   --export=PATH|"|CMD" — офлайн-рендер в PNG-последовательность или сырым RGBA в команду
+ *   --export-size=WxH, --export-frames=N, --export-fps=F — размер, длина и частота экспорта
+ *                                                          (по умолчанию длина — один цикл --loop)
+ */
+struct AppOptions {
+    static constexpr float defaultBlurRadius = 4.0f;
+
+    std::string bake = "auto";
+    NoiseSettings noise;
+    bool noiseReport = false;
+    bool noise4d = false;
+    std::string noiseSource = "auto";   // texture, analytic or auto (NoiseSourceVerdict)
+    float loopSeconds = 0.0f;       // 0 = free-running animation
+    float loopCacheFps = 0.0f;      // 0 = render every frame
+    std::string cacheDir = "noise_cache";
+    std::string profilePath = "frame_profile";
+    bool profileOnExit = false;
+    bool fbmVolume = false;
+    ShaderVariant shader;
+    std::string shaderDir = "src";
+    int sparkCount = SparkParticles::defaultCount;
+    int emitters = 0;               // 0 = one fullscreen fire
+    bool mixedSchemes = false;
+    bool tiles = false;
+    float blurRadius = defaultBlurRadius;  // 0 = no post-processing
+    float renderScale = 1.0f;       // 0 = dynamic
+    double targetMs = 0.0;          // 0 = 90% of the refresh interval
+    bool autoQuality = false;
+    bool volume = false;
+    int windows = 1;                // output windows, sharing the main window's objects
+    float windowTimeOffset = 0.0f;  // animation lead of each further window
+    PresentMode present = PresentMode::VSync;
+    double fpsLimit = 0.0;          // 0 = the refresh rate
+    bool presentLatency = false;
+    bool bench = false;
+    int benchFrames = 200;
+    std::string benchOut = "bench_results.json";
+    std::string exportPath;         // empty = interactive
+    int exportWidth = 1920, exportHeight = 1080;
+    int exportFrames = 0;           // 0 = one loop, or 300 frames without --loop
+    double exportFps = 60.0;
+};
+
+/// Режим, которому нужен сам объём шума, а не только fbm() огня; nullptr — такого нет.
+const char* noiseVolumeUser(const AppOptions& opt) {
+    if (opt.noise4d) return "--noise-4d";
+    if (opt.fbmVolume) return "--fbm-volume";
+    if (opt.tiles) return "--tiles";
+    if (opt.volume) return "--volume";
+    if (opt.noiseReport) return "--noise-report";
+    // hashNoise() wraps like the tiling volume only
+    if (!opt.noise.tiling) return "--no-tiling";
+    return nullptr;
+}
+
+AppOptions parseOptions(int argc, char** argv) {
+    AppOptions opt;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--bake=", 0) == 0) opt.bake = arg.substr(7);
+        else if (arg.rfind("--noise-format=", 0) == 0) {
+            if (!parseNoiseFormat(arg.substr(15), opt.noise.format))
+                std::cerr << "Unknown noise format: " << arg.substr(15) << std::endl;
+        }
+        else if (arg == "--noise-report") opt.noiseReport = true;
+        else if (arg == "--no-tiling") opt.noise.tiling = false;
+        else if (arg == "--noise-4d") opt.noise4d = true;
+        else if (arg.rfind("--noise-source=", 0) == 0) {
+            std::string source = arg.substr(15);
+            if (source == "auto" || source == "texture" || source == "analytic") opt.noiseSource = source;
+            else std::cerr << "Unknown noise source: " << source << std::endl;
+        }
+        else if (arg.rfind("--loop=", 0) == 0) opt.loopSeconds = std::max(0.0f, (float)std::atof(arg.c_str() + 7));
+        else if (arg == "--loop-cache") opt.loopCacheFps = 30.0f;
+        else if (arg.rfind("--loop-cache=", 0) == 0) opt.loopCacheFps = std::max(1.0f, (float)std::atof(arg.c_str() + 13));
+        else if (arg.rfind("--cache-dir=", 0) == 0) opt.cacheDir = arg.substr(12);
+        else if (arg == "--no-cache") opt.cacheDir.clear();
+        else if (arg == "--profile") opt.profileOnExit = true;
+        else if (arg.rfind("--profile=", 0) == 0) {
+            opt.profileOnExit = true;
+            opt.profilePath = arg.substr(10);
+        }
+        else if (arg == "--fbm-volume") opt.fbmVolume = true;
+        else if (arg.rfind("--shader-dir=", 0) == 0) opt.shaderDir = arg.substr(13);
+        else if (arg.rfind("--emitters=", 0) == 0) opt.emitters = std::max(0, std::atoi(arg.c_str() + 11));
+        else if (arg == "--mixed-schemes") opt.mixedSchemes = true;
+        else if (arg == "--tiles") opt.tiles = true;
+        else if (arg == "--shader=full") {
+            opt.shader = ShaderVariant();
+            opt.blurRadius = AppOptions::defaultBlurRadius;
+        }
+        else if (arg == "--shader=lite") {
+            opt.shader = ShaderVariant::lite();
+            opt.blurRadius = 0.0f;
+        }
+        else if (arg.rfind("--octaves=", 0) == 0) opt.shader.octaves = std::min(std::max(std::atoi(arg.c_str() + 10), 1), 8);
+        else if (arg == "--no-sparks") opt.shader.sparks = false;
+        else if (arg == "--no-distortion") opt.shader.distortion = false;
+        else if (arg.rfind("--spark-count=", 0) == 0) opt.sparkCount = std::max(0, std::atoi(arg.c_str() + 14));
+        else if (arg == "--no-blur") opt.blurRadius = 0.0f;
+        else if (arg.rfind("--blur-radius=", 0) == 0) opt.blurRadius = std::max(0.0f, (float)std::atof(arg.c_str() + 14));
+        else if (arg.rfind("--render-scale=", 0) == 0) {
+            std::string value = arg.substr(15);
+            opt.renderScale = value == "auto" ? 0.0f : std::min(std::max((float)std::atof(value.c_str()), 0.1f), 1.0f);
+        }
+        else if (arg.rfind("--target-ms=", 0) == 0) opt.targetMs = std::atof(arg.c_str() + 12);
+        else if (arg == "--quality=auto") opt.autoQuality = true;
+        else if (arg == "--quality=fixed") opt.autoQuality = false;
+        else if (arg == "--volume") opt.volume = true;
+        else if (arg.rfind("--windows=", 0) == 0) opt.windows = std::max(1, std::atoi(arg.c_str() + 10));
+        else if (arg.rfind("--window-time-offset=", 0) == 0) opt.windowTimeOffset = (float)std::atof(arg.c_str() + 21);
+        else if (arg.rfind("--present=", 0) == 0) {
+            if (!parsePresentMode(arg.substr(10), opt.present))
+                std::cerr << "Unknown present mode: " << arg.substr(10) << std::endl;
+        }
+        else if (arg.rfind("--fps-limit=", 0) == 0) {
+            opt.present = PresentMode::Limited;
+            opt.fpsLimit = std::max(1.0, std::atof(arg.c_str() + 12));
+        }
+        else if (arg == "--present-latency") opt.presentLatency = true;
+        else if (arg == "--bench") opt.bench = true;
+        else if (arg.rfind("--bench-frames=", 0) == 0) opt.benchFrames = std::max(1, std::atoi(arg.c_str() + 15));
+        else if (arg.rfind("--bench-out=", 0) == 0) opt.benchOut = arg.substr(12);
+        else if (arg.rfind("--export=", 0) == 0) opt.exportPath = arg.substr(9);
+        else if (arg.rfind("--export-size=", 0) == 0) {
+            int w = 0, h = 0;
+            if (std::sscanf(arg.c_str() + 14, "%dx%d", &w, &h) == 2 && w > 0 && h > 0) {
+                opt.exportWidth = w;
+                opt.exportHeight = h;
+            }
+            else std::cerr << "Invalid export size: " << arg.substr(14) << std::endl;
+        }
+        else if (arg.rfind("--export-frames=", 0) == 0) opt.exportFrames = std::max(1, std::atoi(arg.c_str() + 16));
+        else if (arg.rfind("--export-fps=", 0) == 0) opt.exportFps = std::max(1.0, std::atof(arg.c_str() + 13));
+        else std::cerr << "Unknown option: " << arg << std::endl;
+    }
+    if (opt.volume && (opt.bench || !opt.exportPath.empty())) {
+        std::cerr << "--volume is interactive only, ignoring it for --bench and --export" << std::endl;
+        opt.volume = false;
+    }
+    // The raymarcher scrolls one fire column through the static volume itself
+    if (opt.volume && (opt.noise4d || opt.loopSeconds > 0.0f || opt.fbmVolume || opt.tiles || opt.emitters > 0 ||
+                       opt.autoQuality || opt.renderScale != 1.0f)) {
+        std::cerr << "--volume ignores --noise-4d, --loop, --fbm-volume, --tiles, --emitters, --quality and --render-scale"
+                  << std::endl;
+        opt.noise4d = opt.fbmVolume = opt.tiles = opt.autoQuality = false;
+        opt.loopSeconds = opt.loopCacheFps = 0.0f;
+        opt.emitters = 0;
+        opt.renderScale = 1.0f;
+    }
+    if (opt.volume && !opt.noise.tiling) {
+        std::cerr << "--volume needs the tiling noise volume, ignoring --no-tiling" << std::endl;
+        opt.noise.tiling = true;
+    }
+    // Whole periods of the volume only line up when it wraps
+    if (opt.loopSeconds > 0.0f && !opt.noise.tiling) {
+        std::cerr << "--loop needs the tiling noise volume, ignoring --no-tiling" << std::endl;
+        opt.noise.tiling = true;
+    }
+    if (opt.loopSeconds > 0.0f && opt.noise4d) {
+        std::cerr << "--loop animates the static volume, ignoring --noise-4d" << std::endl;
+        opt.noise4d = false;
+    }
+    if (opt.autoQuality && opt.loopCacheFps > 0.0f) {
+        std::cerr << "--loop-cache plays back prerendered frames, ignoring --quality=auto" << std::endl;
+        opt.autoQuality = false;
+    }
+    if (opt.loopSeconds <= 0.0f && opt.loopCacheFps > 0.0f) {
+        std::cerr << "--loop-cache needs --loop" << std::endl;
+        opt.loopCacheFps = 0.0f;
+    }
+    if (opt.windows > 1 && (opt.bench || !opt.exportPath.empty())) {
+        std::cerr << "--windows is interactive only, ignoring it for --bench and --export" << std::endl;
+        opt.windows = 1;
+    }
+    if (opt.windows > 1 && opt.volume) {
+        std::cerr << "--volume drives a single window, ignoring --windows" << std::endl;
+        opt.windows = 1;
+    }
+    // The 4D ring holds the slices around one time, which offset windows do not share
+    if (opt.windows > 1 && opt.noise4d) {
+        std::cerr << "--windows shares one static volume, ignoring --noise-4d" << std::endl;
+        opt.noise4d = false;
+    }
+    if (opt.noiseSource == "analytic" && noiseVolumeUser(opt)) {
+        std::cerr << noiseVolumeUser(opt) << " needs the noise volume, ignoring --noise-source=analytic" << std::endl;
+        opt.noiseSource = "texture";
+    }
+    return opt;
+}
+
+// ---------- Noise Source ----------
+/**
+ * @brief Сравнение объёма шума и hashNoise() на этом GPU, записанное --bench.
+ *
+ * Лежит в каталоге кэша, отдельный файл на строку драйвера: у каждого GPU и
+ * версии драйвера свой результат. --noise-source=auto читает его при старте,
+ * и если шум в шейдере быстрее, объём шума вовсе не создаётся.
+ */
+struct NoiseSourceVerdict {
+    double textureMs = 0.0;     // median GPU time of the fire pass, 1080p
+    double analyticMs = 0.0;
+
+    bool analyticWins() const { return analyticMs > 0.0 && analyticMs < textureMs; }
+};
+
+std::string noiseSourcePath(const std::string& dir) {
+    std::string driver = glDriverString();
+    std::ostringstream name;
+    name << "noise-source-" << std::hex << std::setw(16) << std::setfill('0')
+         << fnv1a(driver.data(), driver.size()) << ".txt";
+    return (std::filesystem::path(dir) / name.str()).string();
+}
+
+/// Читает результат для текущего драйвера; false — --bench здесь ещё не запускался.
+bool loadNoiseSourceVerdict(const std::string& dir, NoiseSourceVerdict& verdict) {
+    if (dir.empty()) return false;
+    std::ifstream in(noiseSourcePath(dir));
+    std::string driver, texture, analytic;
+    // The driver line guards against a hash collision between GPUs
+    if (!std::getline(in, driver) || driver != glDriverString()) return false;
+    NoiseSourceVerdict loaded;
+    if (!(in >> texture >> loaded.textureMs >> analytic >> loaded.analyticMs) ||
+        texture != "texture" || analytic != "analytic")
+        return false;
+    verdict = loaded;
+    return true;
+}
+
+bool storeNoiseSourceVerdict(const std::string& dir, const NoiseSourceVerdict& verdict) {
+    if (dir.empty()) return false;
+    return writeFileAtomic(noiseSourcePath(dir), [&](std::ostream& out) {
+        out << glDriverString() << "\n"
+            << "texture " << verdict.textureMs << "\n"
+            << "analytic " << verdict.analyticMs << "\n";
+    });
+}
+
+// ---------- Benchmark ----------
+
+/// Экранирует строку для вставки в JSON.
+std::string jsonEscape(const std::string& text) {
+    std::string out;
+    for (char c : text) {
+        if (c == '"' || c == '\\') out += '\\';
+        if ((unsigned char)c >= 0x20) out += c;
+    }
+    return out;
+}
+
+/**
+ * @brief Детерминированный бенчмарк: все разрешения × все цветовые схемы в offscreen FBO.
+ *
+ * Время шейдера берётся из фиксированного шага, а не из glfwGetTime, поэтому
+ * каждый прогон рисует одни и те же кадры. У каждого кадра свой запрос
+ * GL_TIME_ELAPSED; результаты читаются после glFinish, так что очередь GPU
+ * не прерывается.
+ *
+ * @return код возврата процесса
+ */
+int runBenchmark(const AppOptions& options, ShaderCache& shaders, ShaderVariant variant,
+                 FireEmitters& fires, TileClassifier* tiles, PostProcess* post, SparkParticles* sparks,
+                 NoiseTimeRing* noiseRing, RenderGraph& graph,
+                 GLuint vao, GLuint noiseTex, GLuint fbmTex) {
+    struct Resolution { const char* name; int width, height; };
+    const Resolution resolutions[] = { { "720p", 1280, 720 }, { "1080p", 1920, 1080 }, { "4k", 3840, 2160 } };
+    const int colorSchemes = 3;
+    const int warmupFrames = 10;
+    const double timeStep = 1.0 / 60.0;
+    int frames = options.benchFrames;
+
+    glState.activeTexture(GL_TEXTURE1);
+    glState.bindTexture(GL_TEXTURE_3D, fbmTex);
+    glState.activeTexture(GL_TEXTURE0);
+    glState.bindTexture(GL_TEXTURE_3D, noiseTex);
+    const float noJitter[2] = { 0.0f, 0.0f };
+    int visibleFires = fires.upload();
+
+    std::ostringstream results;
+    std::vector<GLuint> queries(frames);
+    glGenQueries(frames, queries.data());
+    for (const Resolution& res : resolutions) {
+        GLuint fbo, color;
+        glGenTextures(1, &color);
+        glState.bindTexture(GL_TEXTURE_2D, color);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, res.width, res.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+
+        for (int mode = 0; mode < colorSchemes; ++mode) {
+            variant.colorScheme = mode;
+            double start = 0.0;
+            for (int i = -warmupFrames; i < frames; ++i) {
+                if (i == 0) {
+                    // Keep the warm-up out of the measured wall time
+                    glFinish();
+                    start = glfwGetTime();
+                }
+                if (i >= 0) glBeginQuery(GL_TIME_ELAPSED, queries[i]);
+                float time = (float)(i * timeStep);
+                if (options.loopSeconds > 0.0f)
+                    time = std::fmod(time, options.loopSeconds);
+                graph.reset();
+                RenderGraph::Target output = graph.importTarget(fbo, res.width, res.height);
+                RenderGraph::Target scene = post ? graph.createTarget(res.width, res.height, PostProcess::sceneFormat) : output;
+                graph.addPass({}, scene, firePassLoad(fires), [&] {
+                    float noiseBlend = noiseRing ? noiseRing->update(time, true) : 0.0f;
+                    drawFires(fires, shaders, variant, tiles, time, noJitter, vao, noiseBlend, options.loopSeconds);
+                });
+                if (sparks && variant.sparks) {
+                    graph.addPass({}, scene, RenderGraph::Load::Keep, [&] {
+                        sparks->update(fires, time, (float)timeStep, options.loopSeconds);
+                        sparks->draw(fires, time, res.height, options.loopSeconds);
+                    });
+                }
+                if (post) post->addPasses(graph, scene, output, vao);
+                graph.execute();
+                if (i >= 0) glEndQuery(GL_TIME_ELAPSED);
+            }
+            glFinish();
+            double seconds = glfwGetTime() - start;
+
+            std::vector<double> gpuMs(frames);
+            for (int i = 0; i < frames; ++i) {
+                GLuint64 ns = 0;
+                glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &ns);
+                gpuMs[i] = ns / 1.0e6;
+            }
+            FrameStats gpu = computeFrameStats(gpuMs);
+            double fps = frames / std::max(seconds, 1e-9);
+            double mpix = fps * res.width * res.height / 1.0e6;
+            std::cout << "Bench " << res.name << " " << variant.name() << ": "
+                      << std::fixed << std::setprecision(1) << fps << " fps, " << mpix << " Mpix/s, GPU p50/p95/p99 "
+                      << std::setprecision(3) << gpu.p50 << " / " << gpu.p95 << " / " << gpu.p99 << " ms"
+                      << std::defaultfloat << std::endl;
+
+            if (results.tellp() > 0) results << ",\n";
+            results << "    { \"resolution\": \"" << res.name << "\", \"width\": " << res.width
+                    << ", \"height\": " << res.height << ", \"color_mode\": " << mode
+                    << ", \"variant\": \"" << variant.name() << "\""
+                    << ", \"fps\": " << fps << ", \"mpix_per_s\": " << mpix
+                    << ", \"gpu_ms\": { \"mean\": " << gpu.mean << ", \"p50\": " << gpu.p50
+                    << ", \"p95\": " << gpu.p95 << ", \"p99\": " << gpu.p99 << ", \"max\": " << gpu.max << " } }";
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &fbo);
+        glState.deleteTextures(1, &color);
+    }
+
+    // Noise source for --noise-source=auto: the fire pass alone, volume vs hashNoise()
+    NoiseSourceVerdict verdict;
+    bool compared = noiseTex && !noiseVolumeUser(options);
+    if (compared) {
+        const Resolution& res = resolutions[1];
+        GLuint fbo, color;
+        glGenTextures(1, &color);
+        glState.bindTexture(GL_TEXTURE_2D, color);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, res.width, res.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+        glState.activeTexture(GL_TEXTURE0);
+        glState.bindTexture(GL_TEXTURE_3D, noiseTex);
+        for (int analytic = 0; analytic < 2; ++analytic) {
+            ShaderVariant v = variant;
+            v.colorScheme = 0;
+            v.analyticNoise = analytic ? options.noise.period() : 0;
+            for (int i = -warmupFrames; i < frames; ++i) {
+                if (i >= 0) glBeginQuery(GL_TIME_ELAPSED, queries[i]);
+                float time = (float)(i * timeStep);
+                if (options.loopSeconds > 0.0f)
+                    time = std::fmod(time, options.loopSeconds);
+                graph.reset();
+                RenderGraph::Target output = graph.importTarget(fbo, res.width, res.height);
+                graph.addPass({}, output, firePassLoad(fires), [&] {
+                    drawFires(fires, shaders, v, nullptr, time, noJitter, vao, 0.0f, options.loopSeconds);
+                });
+                graph.execute();
+                if (i >= 0) glEndQuery(GL_TIME_ELAPSED);
+            }
+            std::vector<double> gpuMs(frames);
+            for (int i = 0; i < frames; ++i) {
+                GLuint64 ns = 0;
+                glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &ns);
+                gpuMs[i] = ns / 1.0e6;
+            }
+            (analytic ? verdict.analyticMs : verdict.textureMs) = computeFrameStats(gpuMs).p50;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &fbo);
+        glState.deleteTextures(1, &color);
+        bool saved = storeNoiseSourceVerdict(options.cacheDir, verdict);
+        std::cout << "Bench noise source " << res.name << ": " << std::fixed << std::setprecision(3)
+                  << "texture " << verdict.textureMs << " ms, analytic " << verdict.analyticMs << " ms GPU p50 -> "
+                  << (verdict.analyticWins() ? "analytic" : "texture") << std::defaultfloat
+                  << (saved ? " (used by --noise-source=auto)" : "") << std::endl;
+    }
+    glDeleteQueries(frames, queries.data());
 
-#define GLSL(src) "#version 330 core\n" #src
+    std::ofstream json(options.benchOut);
+    json << "{\n"
+         << "  \"renderer\": \"" << jsonEscape((const char*)glGetString(GL_RENDERER)) << "\",\n"
+         << "  \"gl_version\": \"" << jsonEscape((const char*)glGetString(GL_VERSION)) << "\",\n"
+         << "  \"noise_format\": \"" << noiseFormatDesc(options.noise.format).name << "\",\n"
+         << "  \"noise_tiling\": " << (options.noise.tiling ? "true" : "false") << ",\n"
+         << "  \"noise_4d\": " << (noiseRing ? "true" : "false") << ",\n"
+         << "  \"loop_seconds\": " << options.loopSeconds << ",\n"
+         << "  \"fbm_volume\": " << (fbmTex ? "true" : "false") << ",\n"
+         << "  \"emitters\": " << visibleFires << ",\n"
+         << "  \"tiles\": " << (tiles ? "true" : "false") << ",\n"
+         << "  \"spark_particles\": " << (sparks && variant.sparks ? options.sparkCount : 0) << ",\n"
+         << "  \"blur_radius\": " << (post ? options.blurRadius : 0.0f) << ",\n"
+         << "  \"frames\": " << frames << ",\n"
+         << "  \"time_step\": " << timeStep << ",\n";
+    if (compared) {
+        json << "  \"noise_source\": { \"texture_ms\": " << verdict.textureMs << ", \"analytic_ms\": " << verdict.analyticMs
+             << ", \"choice\": \"" << (verdict.analyticWins() ? "analytic" : "texture") << "\" },\n";
+    }
+    json << "  \"results\": [\n" << results.str() << "\n  ]\n"
+         << "}\n";
+    if (!json.good()) {
+        std::cerr << "Bench: failed to write " << options.benchOut << std::endl;
+        return 1;
+    }
+    std::cout << "Bench results written to " << options.benchOut << std::endl;
+    return 0;
+}
+
+// ---------- Offline Export ----------
+
+/// CRC-32 (полином 0xEDB88320), которой PNG защищает каждый чанк.
+uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t size) {
+    static const std::vector<uint32_t> table = [] {
+        std::vector<uint32_t> t(256);
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[n] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
 
 /**
- * @class PerlinNoise3D
- * @brief Класс для генерации 3D-шума Перлина.
+ * @brief Кодирует RGBA8-кадр в PNG.
  *
- * Использует перестановочный массив (permutation table) и градиентные функции
- * для создания непрерывного, плавного шума в трёхмерном пространстве.
- * Используется для заполнения 3D-текстуры, передаваемой в шейдер.
+ * Строки приходят снизу вверх, как их отдаёт glReadPixels, и записываются в
+ * обратном порядке. Deflate-поток состоит из несжатых stored-блоков: так не
+ * нужен zlib, а кодирование стоит не больше копирования. Последовательность
+ * всё равно обычно пережимается энкодером.
  */
-// ---------- Perlin Noise ----------
-float fade(float t) { return t * t * t * (t * (t * 6 - 15) + 10); }
-float lerp(float a, float b, float t) { return a + t * (b - a); }
-float grad(int hash, float x, float y, float z) {
-    int h = hash & 15;
-    float u = h < 8 ? x : y;
-    float v = h < 4 ? y : (h == 12 || h == 14 ? x : z);
-    return ((h & 1) ? -u : u) + ((h & 2) ? -v : v);
+void encodePNG(const uint8_t* rgba, int width, int height, std::vector<uint8_t>& out) {
+    auto put32 = [&out](uint32_t v) {
+        for (int shift = 24; shift >= 0; shift -= 8) out.push_back((uint8_t)(v >> shift));
+    };
+    auto chunk = [&](const char* type, const uint8_t* data, size_t size) {
+        put32((uint32_t)size);
+        size_t start = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data, data + size);
+        put32(crc32Update(0, out.data() + start, size + 4));
+    };
+
+    size_t rowBytes = (size_t)width * 4;
+    size_t rawSize = (rowBytes + 1) * height;
+    const size_t maxBlock = 65535;
+    std::vector<uint8_t> zlib;
+    zlib.reserve(rawSize + rawSize / maxBlock * 5 + 16);
+    zlib.push_back(0x78);
+    zlib.push_back(0x01);
+    // Filter type 0 before every row; Adler-32 runs over the filtered rows
+    uint32_t adlerA = 1, adlerB = 0;
+    size_t blockLeft = 0, remaining = rawSize;
+    auto emit = [&](const uint8_t* data, size_t size) {
+        while (size > 0) {
+            if (blockLeft == 0) {
+                blockLeft = std::min(remaining, maxBlock);
+                remaining -= blockLeft;
+                uint16_t len = (uint16_t)blockLeft;
+                zlib.push_back(remaining == 0 ? 1 : 0);
+                zlib.push_back((uint8_t)len);
+                zlib.push_back((uint8_t)(len >> 8));
+                zlib.push_back((uint8_t)~len);
+                zlib.push_back((uint8_t)(~len >> 8));
+            }
+            size_t n = std::min(size, blockLeft);
+            zlib.insert(zlib.end(), data, data + n);
+            for (size_t i = 0; i < n; ++i) {
+                adlerA = (adlerA + data[i]) % 65521;
+                adlerB = (adlerB + adlerA) % 65521;
+            }
+            data += n;
+            size -= n;
+            blockLeft -= n;
+        }
+    };
+    const uint8_t filterNone = 0;
+    for (int y = height - 1; y >= 0; --y) {
+        emit(&filterNone, 1);
+        emit(rgba + rowBytes * y, rowBytes);
+    }
+    uint32_t adler = (adlerB << 16) | adlerA;
+    for (int shift = 24; shift >= 0; shift -= 8) zlib.push_back((uint8_t)(adler >> shift));
+
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    out.assign(signature, signature + 8);
+    uint8_t header[13] = {
+        (uint8_t)(width >> 24), (uint8_t)(width >> 16), (uint8_t)(width >> 8), (uint8_t)width,
+        (uint8_t)(height >> 24), (uint8_t)(height >> 16), (uint8_t)(height >> 8), (uint8_t)height,
+        8, 6, 0, 0, 0   // 8 bit, RGBA, deflate, adaptive filtering, no interlace
+    };
+    chunk("IHDR", header, sizeof(header));
+    chunk("IDAT", zlib.data(), zlib.size());
+    chunk("IEND", nullptr, 0);
 }
 
-class PerlinNoise3D {
+/**
+ * @brief Поток записи кадров экспорта: PNG-последовательность или сырой RGBA в энкодер.
+ *
+ * Цель вида "|команда" открывается через popen, и кадры уходят в её stdin
+ * сырыми RGBA-строками сверху вниз (например, в ffmpeg -f rawvideo). Иначе
+ * цель — шаблон имени файла с одним %d или %0Nd ("out/fire_%05d.png", %% —
+ * сам знак процента) или каталог, куда пишутся fire_00000.png, fire_00001.png
+ * и т.д. Пока канал открыт, SIGPIPE игнорируется: если энкодер завершился
+ * раньше времени, fwrite вернёт ошибку, а не убьёт процесс.
+ *
+ * Рендер-поток только отдаёт буферы в очередь; кодирование и диск работают
+ * здесь. Очередь ограничена, и если диск медленнее GPU, push ждёт, а не
+ * копит гигабайты кадров в памяти. Буферы переиспользуются через acquire.
+ */
+class FrameWriter {
 public:
-    PerlinNoise3D(unsigned int seed = 237) {
-        p.resize(256);
-        std::iota(p.begin(), p.end(), 0);
-        std::default_random_engine engine(seed);
-        std::shuffle(p.begin(), p.end(), engine);
-        p.insert(p.end(), p.begin(), p.end());
-    }
-
-    float noise(float x, float y, float z) const {
-        int X = (int)floor(x) & 255;
-        int Y = (int)floor(y) & 255;
-        int Z = (int)floor(z) & 255;
-
-        x -= floor(x);
-        y -= floor(y);
-        z -= floor(z);
-
-        float u = fade(x), v = fade(y), w = fade(z);
-        int A = p[X] + Y, AA = p[A] + Z, AB = p[A + 1] + Z;
-        int B = p[X + 1] + Y, BA = p[B] + Z, BB = p[B + 1] + Z;
-
-        return lerp(
-            lerp(
-                lerp(grad(p[AA], x, y, z), grad(p[BA], x - 1, y, z), u),
-                lerp(grad(p[AB], x, y - 1, z), grad(p[BB], x - 1, y - 1, z), u),
-                v),
-            lerp(
-                lerp(grad(p[AA + 1], x, y, z - 1), grad(p[BA + 1], x - 1, y, z - 1), u),
-                lerp(grad(p[AB + 1], x, y - 1, z - 1), grad(p[BB + 1], x - 1, y - 1, z - 1), u),
-                v),
-            w);
+    static const int maxQueued = 6;
+
+    FrameWriter(const std::string& target, int width, int height) : width(width), height(height) {
+        if (!target.empty() && target[0] == '|') {
+#ifdef _WIN32
+            pipe = _popen(target.c_str() + 1, "wb");
+#else
+            pipe = popen(target.c_str() + 1, "w");
+#endif
+            if (!pipe) {
+                std::cerr << "Export: failed to start '" << target.substr(1) << "'" << std::endl;
+                return;
+            }
+#ifndef _WIN32
+            // An encoder that exits early must fail the write, not kill the process
+            previousSigpipe = std::signal(SIGPIPE, SIG_IGN);
+            if (previousSigpipe == SIG_ERR) previousSigpipe = SIG_DFL;
+#endif
+        }
+        else if (target.find('%') != std::string::npos) {
+            // The pattern becomes a printf format, so only one integer conversion is allowed
+            if (!isFramePattern(target)) {
+                std::cerr << "Export: '" << target << "' is not a frame pattern, use one %d or %0Nd "
+                          << "and %% for a literal %" << std::endl;
+                return;
+            }
+            pattern = target;
+        }
+        else {
+            pattern = (std::filesystem::path(target) / "fire_%05d.png").string();
+        }
+        if (!pipe) {
+            std::error_code ec;
+            std::filesystem::create_directories(std::filesystem::path(frameName(0)).parent_path(), ec);
+        }
+        worker = std::thread([this] { writeLoop(); });
+    }
+
+    ~FrameWriter() { finish(); }
+
+    bool ok() const { return worker.joinable() && !failed; }
+
+    /// Буфер под один кадр: из отработавших, если они есть.
+    std::vector<uint8_t> acquire() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<uint8_t> buffer;
+        if (!spare.empty()) {
+            buffer.swap(spare.back());
+            spare.pop_back();
+        }
+        buffer.resize((size_t)width * height * 4);
+        return buffer;
+    }
+
+    /// Ставит кадр (строки снизу вверх) в очередь записи; ждёт, если очередь полна.
+    void push(std::vector<uint8_t> frame) {
+        std::unique_lock<std::mutex> lock(mutex);
+        space.wait(lock, [this] { return (int)queue.size() < maxQueued; });
+        queue.push_back(std::move(frame));
+        ready.notify_one();
+    }
+
+    /// Дописывает очередь и закрывает цель; false, если какой-то кадр не записался.
+    bool finish() {
+        if (worker.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            ready.notify_one();
+            worker.join();
+        }
+        if (pipe) {
+#ifdef _WIN32
+            if (_pclose(pipe) != 0) failed = true;
+#else
+            if (pclose(pipe) != 0) failed = true;
+            std::signal(SIGPIPE, previousSigpipe);
+#endif
+            pipe = nullptr;
+        }
+        return !failed;
+    }
+
+    /// Ровно одно %d / %0Nd, а кроме него только %%.
+    static bool isFramePattern(const std::string& target) {
+        int conversions = 0;
+        for (size_t i = 0; i < target.size(); ++i) {
+            if (target[i] != '%') continue;
+            if (++i < target.size() && target[i] == '%') continue;
+            if (i < target.size() && target[i] == '0') ++i;
+            while (i < target.size() && target[i] >= '0' && target[i] <= '9') ++i;
+            if (i >= target.size() || target[i] != 'd') return false;
+            ++conversions;
+        }
+        return conversions == 1;
+    }
+
+    int written() const { return framesWritten; }
+    std::string frameName(int index) const {
+        std::vector<char> name(pattern.size() + 32);
+        std::snprintf(name.data(), name.size(), pattern.c_str(), index);
+        return name.data();
     }
 
 private:
-    std::vector<int> p;
+    void writeLoop() {
+        std::vector<uint8_t> encoded, row((size_t)width * 4);
+        for (;;) {
+            std::vector<uint8_t> frame;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+                frame.swap(queue.front());
+                queue.pop_front();
+            }
+            space.notify_one();
+
+            bool good;
+            if (pipe) {
+                size_t rowBytes = (size_t)width * 4;
+                good = true;
+                for (int y = height - 1; y >= 0 && good; --y)
+                    good = std::fwrite(frame.data() + rowBytes * y, 1, rowBytes, pipe) == rowBytes;
+            }
+            else {
+                encodePNG(frame.data(), width, height, encoded);
+                std::string name = frameName(framesWritten);
+                good = writeFileAtomic(name, [&encoded](std::ofstream& out) {
+                    out.write((const char*)encoded.data(), (std::streamsize)encoded.size());
+                });
+            }
+            if (!good && !failed) {
+                std::cerr << "Export: failed to write frame " << framesWritten << std::endl;
+                failed = true;
+            }
+            framesWritten++;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            spare.push_back(std::move(frame));
+        }
+    }
+
+    int width, height;
+    std::string pattern;
+    FILE* pipe = nullptr;
+#ifndef _WIN32
+    void (*previousSigpipe)(int) = SIG_DFL;
+#endif
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable ready, space;
+    std::deque<std::vector<uint8_t>> queue;
+    std::vector<std::vector<uint8_t>> spare;
+    bool stopping = false;
+    std::atomic<bool> failed{ false };
+    std::atomic<int> framesWritten{ 0 };
 };
 
 /**
- * @brief Создаёт 3D-текстуру на основе шума Перлина.
+ * @brief Офлайн-рендер петли огня в файлы или энкодер.
  *
- * Текстура заполняется значениями шума в диапазоне [0, 1],
- * нормализованными из [-1, 1]. Используется в шейдере как `sampler3D`.
+ * Кадры рисуются с фиксированным шагом 1/fps в FBO заданного размера, который
+ * может быть больше экрана. glReadPixels пишет в одну из pboCount
+ * GL_PIXEL_PACK_BUFFER и сразу возвращается; за ним ставится fence. Буфер
+ * мапится только через pboCount кадров, когда GPU его давно заполнил, так что
+ * рендер-поток не ждёт ни чтения, ни диска, и скорость упирается в GPU.
  *
- * @param size — размер текстуры по каждой оси (size x size x size)
- * @param frequency — частота шума (меньше = плавнее)
- * @return GLuint — ID созданной OpenGL-текстуры
+ * @return код возврата процесса
  */
-GLuint create3DNoiseTexture(int size, float frequency) {
-    std::vector<float> data(size * size * size);
-    PerlinNoise3D perlin;
-    int idx = 0;
-    for (int z = 0; z < size; ++z)
-        for (int y = 0; y < size; ++y)
-            for (int x = 0; x < size; ++x)
-                data[idx++] = 0.5f + 0.5f * perlin.noise(x * frequency, y * frequency, z * frequency);
-
-    GLuint tex;
-    glGenTextures(1, &tex);
-    glBindTexture(GL_TEXTURE_3D, tex);
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_RED, size, size, size, 0, GL_RED, GL_FLOAT, data.data());
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    return tex;
-}
+int runExport(const AppOptions& options, ShaderCache& shaders, const ShaderVariant& variant,
+              FireEmitters& fires, TileClassifier* tiles, PostProcess* post, SparkParticles* sparks,
+              NoiseTimeRing* noiseRing, RenderGraph& graph,
+              GLuint vao, GLuint noiseTex, GLuint fbmTex) {
+    const int pboCount = 4;
+    int width = options.exportWidth, height = options.exportHeight;
+    int frames = options.exportFrames;
+    if (frames <= 0)
+        frames = options.loopSeconds > 0.0f ? std::max(1, (int)std::lround(options.loopSeconds * options.exportFps)) : 300;
+    double timeStep = 1.0 / options.exportFps;
 
-// ---------- Shaders ----------
-const char* vertexShaderSrc = GLSL(
-    layout(location = 0) in vec2 pos;
-    out vec2 uv;
-    void main() {
-        uv = pos * 0.5 + 0.7;
-        gl_Position = vec4(pos, 0.0, 1.0);
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &maxSize);
+    GLint maxTexture = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTexture);
+    maxSize = std::min(maxSize, maxTexture);
+    if (width > maxSize || height > maxSize) {
+        std::cerr << "Export: " << width << "x" << height << " exceeds the maximum framebuffer size "
+                  << maxSize << std::endl;
+        return 1;
     }
-);
+    FrameWriter writer(options.exportPath, width, height);
+    if (!writer.ok())
+        return 1;
 
-// --- Fragment shader: fire + smoke composition ---
-const char* fragmentShaderSrc = GLSL(
-    out vec4 FragColor;
-in vec2 uv;
-uniform sampler3D noiseTex;
-uniform float time;
-uniform int colorMode;
+    GLuint fbo, color;
+    glGenTextures(1, &color);
+    glState.bindTexture(GL_TEXTURE_2D, color);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Export: framebuffer " << width << "x" << height << " is incomplete" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &fbo);
+        glState.deleteTextures(1, &color);
+        return 1;
+    }
 
-// FBM with more octaves for detail
-float fbm(vec3 p) {
-    float v = 0.0;
-    float a = 0.5;
-    for (int i = 0; i < 6; i++) {
-        v += a * texture(noiseTex, p).r;
-        p *= 2.0;
-        a *= 0.5;
+    size_t frameBytes = (size_t)width * height * 4;
+    GLuint pbos[pboCount];
+    GLsync fences[pboCount] = {};
+    glGenBuffers(pboCount, pbos);
+    for (GLuint pbo : pbos) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)frameBytes, nullptr, GL_STREAM_READ);
     }
-    return v;
-}
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
 
-// Spark particles
-float sparks(vec2 uv, float t) {
-    // Use high-frequency noise for particles
-    vec3 p = vec3(uv * 8.0, t * 0.3);
-    float n = fbm(p + vec3(100.0, 0.0, 0.0)); // offset to avoid fire pattern
-    // Only in lower half, with pulsing
-    float height = 1.0 - smoothstep(0.2, 0.8, uv.y);
-    float pulse = sin(t * 10.0 + uv.x * 50.0) * 0.5 + 0.5;
-    return n * height * pulse * 0.7;
-}
+    // Waits for the oldest readback, copies it out and hands it to the writer
+    auto retire = [&](int slot) {
+        while (glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 100000000) == GL_TIMEOUT_EXPIRED) {}
+        glDeleteSync(fences[slot]);
+        fences[slot] = nullptr;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[slot]);
+        const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)frameBytes, GL_MAP_READ_BIT);
+        std::vector<uint8_t> frame = writer.acquire();
+        if (pixels) std::memcpy(frame.data(), pixels, frameBytes);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        writer.push(std::move(frame));
+    };
 
-vec3 getFireColor(float fire) {
-    if (colorMode == 1) {
-        return mix(vec3(0.8, 0.1, 0.0), vec3(1.0, 0.4, 0.0), fire * 2.0);
-    }
-    else if (colorMode == 2) {
-        return mix(vec3(0.0, 0.2, 0.8), vec3(0.2, 0.8, 1.0), fire * 2.0);
+    glState.activeTexture(GL_TEXTURE1);
+    glState.bindTexture(GL_TEXTURE_3D, fbmTex);
+    glState.activeTexture(GL_TEXTURE0);
+    glState.bindTexture(GL_TEXTURE_3D, noiseTex);
+    const float noJitter[2] = { 0.0f, 0.0f };
+
+    std::cout << "Export: " << frames << " frames " << width << "x" << height << " at "
+              << options.exportFps << " fps -> " << options.exportPath << std::endl;
+    double start = glfwGetTime();
+    int submitted = 0;
+    for (int i = 0; i < frames && writer.ok(); ++i) {
+        int slot = i % pboCount;
+        if (fences[slot]) retire(slot);
+
+        float time = (float)(i * timeStep);
+        if (options.loopSeconds > 0.0f)
+            time = std::fmod(time, options.loopSeconds);
+        graph.reset();
+        RenderGraph::Target output = graph.importTarget(fbo, width, height);
+        RenderGraph::Target scene = post ? graph.createTarget(width, height, PostProcess::sceneFormat) : output;
+        graph.addPass({}, scene, firePassLoad(fires), [&] {
+            float noiseBlend = noiseRing ? noiseRing->update(time, true) : 0.0f;
+            drawFires(fires, shaders, variant, tiles, time, noJitter, vao, noiseBlend, options.loopSeconds);
+        });
+        if (sparks && variant.sparks) {
+            graph.addPass({}, scene, RenderGraph::Load::Keep, [&] {
+                sparks->update(fires, time, (float)timeStep, options.loopSeconds);
+                sparks->draw(fires, time, height, options.loopSeconds);
+            });
+        }
+        if (post) post->addPasses(graph, scene, output, vao);
+        graph.execute();
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[slot]);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        submitted++;
     }
-    else {
-        return mix(vec3(1.0, 0.4, 0.0), vec3(1.0, 1.0, 0.2), fire * 2.0);
+    // Drain the ring in submission order
+    for (int i = 0; i < pboCount; ++i) {
+        int slot = (submitted + i) % pboCount;
+        if (fences[slot]) retire(slot);
     }
-}
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    bool ok = writer.finish();
+    double seconds = glfwGetTime() - start;
 
-void main() {
-    float t = time * 0.2;
-    vec3 p = vec3(uv.x * 1.5, uv.y * 2.5 + t, t * 0.5);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteBuffers(pboCount, pbos);
+    glDeleteFramebuffers(1, &fbo);
+    glState.deleteTextures(1, &color);
 
-    float fire = pow(fbm(p), 3.0);
-    float smoke = smoothstep(0.4, 0.9, fbm(p + vec3(0.0, 1.0, -t * 0.2)));
-    float heightMask = smoothstep(0.2, 1.0, uv.y);
+    std::cout << "Export: " << writer.written() << " frames in " << std::fixed << std::setprecision(2)
+              << seconds << " s (" << std::setprecision(1) << writer.written() / std::max(seconds, 1e-9)
+              << " fps)" << std::defaultfloat << std::endl;
+    return ok ? 0 : 1;
+}
 
-    // --- Heat Distortion ---
-    // Distort UV based on fire intensity and gradient
-    vec2 distortion = vec2(
-        fbm(p + vec3(0.5, 0.0, t * 0.3)) - 0.5,
-        fbm(p + vec3(0.0, 0.5, t * 0.3)) - 0.5
-    ) * fire * 0.03; // scale distortion
+// ---------- Input ----------
+/**
+ * @brief Интерактивное состояние, которое меняют клавиатура и мышь.
+ *
+ * Колбэки GLFW только записывают сюда изменения и поднимают dirty; главный
+ * цикл применяет их (вариант шейдера, uniform'ы) и сбрасывает флаг.
+ * Удерживаемые клавиши (+ / -, стрелки) меняют значения со скоростью в
+ * секунду в update(), поэтому результат не зависит от частоты кадров.
+ */
+struct RenderState {
+    static constexpr float speedPerSecond = 2.0f;       // while + or - is held
+    static constexpr float orbitPerSecond = 1.8f;       // radians, while an arrow is held
+    static constexpr float zoomPerSecond = 1.2f;        // distance doubles in ~0.6 s with Page Down
+    static constexpr float dragRadiansPerPixel = 0.01f;
+    /// Пока пауза, цикл ждёт событий не дольше этого (горячая перезагрузка шейдеров).
+    static constexpr double idleWaitSeconds = 0.25;
 
-    vec2 distortedUV = uv + distortion;
+    bool paused = false;
+    float baseTime = 0.0f;      // time shown while paused
+    float speed = 1.0f;         // fire animation speed multiplier
+    int colorScheme = 0;
+    bool fbmVolume = false;
+    bool fbmAvailable = false;  // F only switches when the volume was baked
+    bool orbitEnabled = false;  // --volume
+    OrbitCamera camera;
+    bool profileRequested = false;
+    bool dirty = true;          // something above changed since the last frame
+    bool exposed = false;       // the window asked for its contents to be redrawn
 
-    // Recompute fire with distorted UV for consistency
-    vec3 pDistorted = vec3(distortedUV.x * 1.5, distortedUV.y * 2.5 + t, t * 0.5);
-    float fireDistorted = pow(fbm(pDistorted), 3.0);
-    vec3 colFire = getFireColor(fireDistorted);
+    /// Удерживаемые клавиши: -1, 0 или +1 по каждой оси.
+    int speedHeld = 0, yawHeld = 0, pitchHeld = 0, zoomHeld = 0;
+    bool dragging = false;
+    double dragX = 0.0, dragY = 0.0;
 
-    // --- Smoke ---
-    vec3 colSmoke = mix(vec3(0.1), vec3(0.4), smoke);
-    vec3 finalColor = mix(colFire, colSmoke, heightMask);
+    /// Меняется ли что-то само, без новых событий.
+    bool held() const { return speedHeld || yawHeld || pitchHeld || zoomHeld; }
 
-    // --- Add sparks ---
-    float sparkIntensity = sparks(uv, t);
-    finalColor += vec3(1.0, 0.8, 0.3) * sparkIntensity;
+    /// Продвигает удерживаемые клавиши на dt секунд.
+    void update(float dt) {
+        if (speedHeld)
+            speed = std::min(std::max(speed + speedHeld * speedPerSecond * dt, 0.1f), 3.0f);
+        if (yawHeld || pitchHeld)
+            camera.rotate(yawHeld * orbitPerSecond * dt, pitchHeld * orbitPerSecond * dt);
+        if (zoomHeld)
+            camera.zoom(std::exp(zoomHeld * zoomPerSecond * dt));
+        dirty |= held();
+    }
 
-    // --- Subtle blur ---
-    vec3 blurred = vec3(0.0);
-    float step = 0.0015;
-    for (int i = -1; i <= 1; i++) {
-        for (int j = -1; j <= 1; j++) {
-            vec2 offset = vec2(float(i), float(j)) * step;
-            blurred += texture(noiseTex, vec3(uv + offset, t * 0.1)).rgb;
+    void onKey(int key, int action) {
+        if (action == GLFW_REPEAT) return;
+        bool press = action == GLFW_PRESS;
+        int hold = press ? 1 : 0;
+        switch (key) {
+        case GLFW_KEY_EQUAL: case GLFW_KEY_KP_ADD:           speedHeld = hold; break;
+        case GLFW_KEY_MINUS: case GLFW_KEY_KP_SUBTRACT:      speedHeld = -hold; break;
+        case GLFW_KEY_LEFT:      if (orbitEnabled) yawHeld = -hold; break;
+        case GLFW_KEY_RIGHT:     if (orbitEnabled) yawHeld = hold; break;
+        case GLFW_KEY_UP:        if (orbitEnabled) pitchHeld = hold; break;
+        case GLFW_KEY_DOWN:      if (orbitEnabled) pitchHeld = -hold; break;
+        case GLFW_KEY_PAGE_UP:   if (orbitEnabled) zoomHeld = -hold; break;
+        case GLFW_KEY_PAGE_DOWN: if (orbitEnabled) zoomHeld = hold; break;
+        default:
+            if (!press) return;
+            // Space: pause toggle
+            if (key == GLFW_KEY_SPACE) {
+                paused = !paused;
+                if (paused) baseTime = (float)glfwGetTime();
+            }
+            // C: color mode toggle
+            else if (key == GLFW_KEY_C) colorScheme = (colorScheme + 1) % 3;
+            // R: reset
+            else if (key == GLFW_KEY_R) {
+                speed = 1.0f;
+                colorScheme = 0;
+                paused = false;
+                camera = OrbitCamera();
+            }
+            // F: A/B between the octave loop and the FBM volume
+            else if (key == GLFW_KEY_F) fbmVolume = !fbmVolume && fbmAvailable;
+            // P: dump frame profile
+            else if (key == GLFW_KEY_P) profileRequested = true;
+            else return;
+            break;
         }
+        dirty = true;
     }
-    blurred /= 9.0;
-    finalColor = mix(finalColor, blurred, 0.08); // 8% blur
 
-    FragColor = vec4(finalColor, 1.0);
-}
-);
+    /**
+     * @brief Перетаскивание левой кнопкой вращает камеру --volume.
+     *
+     * Кнопка читается при движении курсора: колбэк кнопок мыши в прилагаемом
+     * glfw3.h объявлен с нестандартной сигнатурой.
+     */
+    void onCursor(GLFWwindow* window, double x, double y) {
+        bool pressed = orbitEnabled && glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+        if (pressed && dragging) {
+            camera.rotate((float)(dragX - x) * dragRadiansPerPixel, (float)(y - dragY) * dragRadiansPerPixel);
+            dirty = true;
+        }
+        dragging = pressed;
+        dragX = x;
+        dragY = y;
+    }
 
-// ---------- Shader Setup ----------
-GLuint compileShader(GLenum type, const char* src) {
-    GLuint shader = glCreateShader(type);
-    glShaderSource(shader, 1, &src, nullptr);
-    glCompileShader(shader);
-    int success;
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        char info[512];
-        glGetShaderInfoLog(shader, 512, nullptr, info);
-        std::cerr << "Shader error:\n" << info << std::endl;
+    /// Направляет колбэки окна в этот объект.
+    void attach(GLFWwindow* window) {
+        glfwSetWindowUserPointer(window, this);
+        glfwSetKeyCallback(window, [](GLFWwindow* w, int key, int, int action, int) {
+            static_cast<RenderState*>(glfwGetWindowUserPointer(w))->onKey(key, action);
+        });
+        glfwSetCursorPosCallback(window, [](GLFWwindow* w, double x, double y) {
+            static_cast<RenderState*>(glfwGetWindowUserPointer(w))->onCursor(w, x, y);
+        });
+        glfwSetWindowRefreshCallback(window, [](GLFWwindow* w) {
+            static_cast<RenderState*>(glfwGetWindowUserPointer(w))->exposed = true;
+        });
     }
-    return shader;
-}
+};
 
 /**
- * @brief Компилирует и линкует вершинный и фрагментный шейдеры.
+ * @brief Копия последнего показанного кадра для повторного показа без рендера.
  *
- * Возвращает ID готовой шейдерной программы.
- * Обработка ошибок компиляции осуществляется через stderr.
+ * На паузе кадр не меняется, поэтому главный цикл перестаёт рендерить и
+ * обменивать буферы; если окно потеряло содержимое (expose), кадр
+ * возвращается в back buffer одним blit'ом вместо полного прохода FBM.
+ */
+class FrameCache {
+public:
+    FrameCache() {
+        glGenFramebuffers(1, &fbo);
+        glGenRenderbuffers(1, &color);
+    }
+
+    ~FrameCache() {
+        glDeleteFramebuffers(1, &fbo);
+        glDeleteRenderbuffers(1, &color);
+    }
+
+    FrameCache(const FrameCache&) = delete;
+    FrameCache& operator=(const FrameCache&) = delete;
+
+    /// Копирует готовый кадр из back buffer; вызывать перед glfwSwapBuffers.
+    void store(int w, int h) {
+        if (w != width || h != height) {
+            width = w;
+            height = h;
+            glBindRenderbuffer(GL_RENDERBUFFER, color);
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+            glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+        }
+        blit(0, fbo);
+        valid = true;
+    }
+
+    /// Возвращает сохранённый кадр в back buffer; false — кадра этого размера нет.
+    bool present(int w, int h) {
+        if (!valid || w != width || h != height) return false;
+        blit(fbo, 0);
+        return true;
+    }
+
+private:
+    void blit(GLuint from, GLuint to) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, from);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, to);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    GLuint fbo = 0, color = 0;
+    int width = 0, height = 0;
+    bool valid = false;
+};
+
+// ---------- Output Windows ----------
+/// Общая для всех окон часть кадра; заполняется главным циклом.
+struct OutputFrame {
+    ShaderCache* shaders = nullptr;
+    ShaderVariant variant;
+    PostProcess* post = nullptr;    // programs only, so one instance serves every context
+    GLuint noiseTex = 0, fbmTex = 0;
+    float time = 0.0f;              // shader time of the main window
+    float delta = 0.0f;
+    float loopSeconds = 0.0f;       // LOOP: length of one cycle
+    bool paused = false;
+};
+
+/**
+ * @brief Дополнительное окно вывода (--windows=N), например на другом мониторе.
  *
- * @return GLuint — ID шейдерной программы
+ * Контекст окна создаётся с общими объектами главного, поэтому объём шума и
+ * программы огня и постобработки существуют в одном экземпляре на процесс.
+ * Свои у окна только объекты, которые GL между контекстами не разделяет
+ * (VAO, FBO, transform feedback): огни со своей раскладкой и сдвигом шума,
+ * искры, граф кадра и кэш кадра для паузы. Главный цикл рисует все окна по
+ * очереди; vsync ждёт только главное окно, остальные показывают кадр без ожидания.
  */
-GLuint createShaderProgram() {
-    GLuint vs = compileShader(GL_VERTEX_SHADER, vertexShaderSrc);
-    GLuint fs = compileShader(GL_FRAGMENT_SHADER, fragmentShaderSrc);
-    GLuint prog = glCreateProgram();
-    glAttachShader(prog, vs);
-    glAttachShader(prog, fs);
-    glLinkProgram(prog);
-    glDeleteShader(vs);
-    glDeleteShader(fs);
-    return prog;
-}
+class OutputWindow {
+public:
+    /// Сдвиг области шума между соседними окнами, чтобы огни не повторялись.
+    static constexpr float seedShift = 7.31f;
+
+    /**
+     * @param index — номер окна, 1..N-1 (0 — главное окно)
+     * @param share — главное окно, чьи объекты разделяет контекст
+     * @param analyticNoise — ShaderVariant::analyticNoise главного окна (для искр)
+     */
+    OutputWindow(int index, GLFWwindow* share, const AppOptions& options, const GLCaps& caps, int analyticNoise)
+        : timeOffset(index * options.windowTimeOffset) {
+        std::string title = "Fire & Smoke (Interactive) | output " + std::to_string(index + 1);
+        window = glfwCreateWindow(800, 600, title.c_str(), NULL, share);
+        if (!window) return;
+        // One window per monitor while there are monitors left, then cascade
+        int monitorCount = 0;
+        GLFWmonitor** monitors = glfwGetMonitors(&monitorCount);
+        int x = 0, y = 0;
+        if (index < monitorCount) {
+            glfwGetMonitorPos(monitors[index], &x, &y);
+            glfwSetWindowPos(window, x + 50, y + 50);
+        }
+        else {
+            glfwSetWindowPos(window, 50 + 40 * index, 50 + 40 * index);
+        }
+
+        makeContextCurrent(window);
+        glfwSwapInterval(0);
+        glGenVertexArrays(1, &vao);
+        fires.reset(new FireEmitters(caps.bufferStorage));
+        if (options.emitters > 0)
+            fires->emitters = makeTorchWall(options.emitters, options.mixedSchemes);
+        else
+            fires->emitters.push_back(FireEmitter());
+        for (FireEmitter& emitter : fires->emitters)
+            emitter.seedOffset += index * seedShift;
+        if (options.shader.sparks && options.sparkCount > 0)
+            sparks.reset(new SparkParticles(options.sparkCount, *fires, analyticNoise));
+        graph.reset(new RenderGraph());
+        cache.reset(new FrameCache());
+    }
+
+    ~OutputWindow() {
+        if (!window) return;
+        makeContextCurrent(window);
+        cache.reset();
+        graph.reset();
+        sparks.reset();
+        fires.reset();
+        glState.deleteVertexArrays(1, &vao);
+        makeContextCurrent(nullptr);
+        forgetContext(window);
+        glfwDestroyWindow(window);
+    }
+
+    OutputWindow(const OutputWindow&) = delete;
+    OutputWindow& operator=(const OutputWindow&) = delete;
+
+    bool ok() const { return window != nullptr; }
+    GLFWwindow* handle() const { return window; }
+
+    /**
+     * @brief Рисует и показывает кадр окна; его контекст остаётся текущим.
+     *
+     * @param idle — главное окно стоит на паузе и ничего не рисует: кадр
+     *               рисуется, только если окно сменило размер, а если его
+     *               перекрывали (exposed), возвращается сохранённый кадр
+     */
+    void show(const OutputFrame& frame, bool idle, bool exposed) {
+        makeContextCurrent(window);
+        int width, height;
+        glfwGetFramebufferSize(window, &width, &height);
+        if (width <= 0 || height <= 0) return;
+        if (idle && width == shownWidth && height == shownHeight) {
+            if (exposed && cache->present(width, height))
+                glfwSwapBuffers(window);
+            return;
+        }
+
+        float time = frame.time + timeOffset;
+        if (frame.loopSeconds > 0.0f)
+            time = std::fmod(time, frame.loopSeconds);
+        const float noJitter[2] = { 0.0f, 0.0f };
+        RenderGraph& g = *graph;
+        g.reset();
+        RenderGraph::Target backbuffer = g.importTarget(0, width, height);
+        RenderGraph::Target scene = frame.post ? g.createTarget(width, height, PostProcess::sceneFormat) : backbuffer;
+        g.addPass({}, scene, firePassLoad(*fires), [&] {
+            glState.activeTexture(GL_TEXTURE1);
+            glState.bindTexture(GL_TEXTURE_3D, frame.fbmTex);
+            glState.activeTexture(GL_TEXTURE0);
+            glState.bindTexture(GL_TEXTURE_3D, frame.noiseTex);
+            drawFires(*fires, *frame.shaders, frame.variant, nullptr, time, noJitter, vao, 0.0f, frame.loopSeconds);
+        });
+        if (sparks && frame.variant.sparks) {
+            g.addPass({}, scene, RenderGraph::Load::Keep, [&] {
+                sparks->update(*fires, time, frame.delta, frame.loopSeconds);
+                sparks->draw(*fires, time, height, frame.loopSeconds);
+            });
+        }
+        if (frame.post) frame.post->addPasses(g, scene, backbuffer, vao);
+        g.execute();
+
+        if (frame.paused)
+            cache->store(width, height);
+        shownWidth = width;
+        shownHeight = height;
+        glfwSwapBuffers(window);
+    }
+
+private:
+    GLFWwindow* window = nullptr;
+    float timeOffset;
+    GLuint vao = 0;
+    std::unique_ptr<FireEmitters> fires;
+    std::unique_ptr<SparkParticles> sparks;
+    std::unique_ptr<RenderGraph> graph;
+    std::unique_ptr<FrameCache> cache;
+    int shownWidth = 0, shownHeight = 0;
+};
 
 // ---------- Main ----------
-int main() {
+int main(int argc, char** argv) {
+    AppOptions options = parseOptions(argc, argv);
+
     // FPS counter
     double lastTime = glfwGetTime();
     int frameCount = 0;
@@ -277,111 +5837,437 @@ int main() {
         return -1;
     }
 
+    // The benchmark and the export render offscreen, the window only provides the context
+    bool offscreen = options.bench || !options.exportPath.empty();
+    if (offscreen)
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
     GLFWwindow* window = glfwCreateWindow(800, 600, "Fire & Smoke (Interactive)", NULL, NULL);
     if (!window) {
         std::cerr << "Failed to create GLFW window\n";
         glfwTerminate();
         return -1;
     }
-    glfwMakeContextCurrent(window);
+    makeContextCurrent(window);
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
         std::cerr << "Failed to initialize GLAD\n";
         glfwTerminate();
         return -1;
     }
+    GLCaps caps = detectGLCaps();
+    if (options.noise.format == NoiseFormat::BC4 && !caps.rgtc3d) {
+        std::cerr << "--noise-format=bc4: this driver does not accept RGTC for 3D textures, using r8" << std::endl;
+        options.noise.format = NoiseFormat::R8;
+    }
 
-    // Fullscreen quad
-    float quadVertices[] = {
-        -1, -1,  1, -1,  -1, 1,
-         1, -1,  1,  1,  -1, 1
-    };
-    GLuint vao, vbo;
+    // Screen passes and fire quads take their corners from gl_VertexID;
+    // core profile still needs a VAO bound for the draw
+    GLuint vao;
     glGenVertexArrays(1, &vao);
-    glGenBuffers(1, &vbo);
-    glBindVertexArray(vao);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), quadVertices, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
 
-    GLuint noiseTex = create3DNoiseTexture(256, 0.04f); // ↑ resolution, ↓ frequency for smoother fbm
-    GLuint shader = createShaderProgram();
+    // In-shader noise needs no volume at all; --bench times both and keeps the result.
+    // The benchmark itself always bakes the volume so that it can compare
+    bool analyticNoise = false;
+    if (!noiseVolumeUser(options)) {
+        NoiseSourceVerdict verdict;
+        if (options.noiseSource == "analytic") {
+            analyticNoise = true;
+            std::cout << "Noise source: analytic (hashNoise() in the shader)" << std::endl;
+        }
+        else if (options.noiseSource == "auto" && !options.bench && loadNoiseSourceVerdict(options.cacheDir, verdict)) {
+            analyticNoise = verdict.analyticWins();
+            std::cout << "Noise source: " << (analyticNoise ? "analytic" : "texture") << " (--bench on this GPU: texture "
+                      << verdict.textureMs << " ms, analytic " << verdict.analyticMs << " ms)" << std::endl;
+        }
+    }
 
-    // Uniform locations (cache them!)
-    int timeLoc = glGetUniformLocation(shader, "time");
-    int colorModeLoc = glGetUniformLocation(shader, "colorMode");
+    GLuint noiseTex = 0;
+    std::unique_ptr<NoiseTimeRing> noiseRing;
+    std::unique_ptr<NoiseStreamer> noiseStreamer;
+    if (options.noise4d) {
+        noiseRing.reset(new NoiseTimeRing(options.noise));
+    }
+    else if (!analyticNoise || options.bench) {
+        // The report needs the float reference, which only the CPU bake produces
+        if (!options.cacheDir.empty() && !options.noiseReport)
+            noiseTex = loadNoiseTextureFromCache(options.cacheDir, options.noise);
+        if (!noiseTex && options.bake != "cpu" && !options.noiseReport)
+            noiseTex = create3DNoiseTextureGPU(options.noise, caps, vao);
+        // The CPU bake runs in the background behind a coarse placeholder; BC4 needs the
+        // whole volume for its CPU mip chain and the report blocks anyway
+        if (!noiseTex && !options.noiseReport && !offscreen && options.noise.format != NoiseFormat::BC4) {
+            noiseStreamer.reset(new NoiseStreamer(options.noise, options.cacheDir));
+            noiseTex = createPlaceholderNoiseTexture(options.noise);
+        }
+        if (!noiseTex)
+            noiseTex = create3DNoiseTexture(options.noise, options.noiseReport, options.cacheDir);
+    }
+    // The FBM volume and the tile classifier sample the static volume
+    GLuint fbmTex = options.fbmVolume && !noiseRing ? createFBMVolume(noiseTex, options.noise, vao) : 0;
 
-    // Interactive state
-    bool paused = false;
-    float baseTime = 0.0f;
-    float speed = 1.0f;        // fire animation speed multiplier
-    int colorMode = 0;         // 0 = classic fire, 1 = lava, 2 = blue flame
-    // В начале main(), до цикла while:
-    bool keySpacePressed = false;
-    bool keyCPressed = false;
-    bool keyRPressed = false;
+    // Uniform locations (cache them!) — every variant is compiled once
+    ProgramBinaryCache programBinaries(options.cacheDir, caps.programBinary);
+    ShaderSources shaderSources;
+    ShaderWatcher shaderWatcher(options.shaderDir);
+    if (shaderWatcher.load(shaderSources))
+        std::cout << "Shaders: " << options.shaderDir << "/shader.vert, shader.frag (hot reload)" << std::endl;
+    else if (!options.shaderDir.empty())
+        std::cout << "Shaders: built-in (no shader files in '" << options.shaderDir << "')" << std::endl;
+    ShaderCache shaders(shaderSources, &programBinaries, caps.parallelShaderCompile);
+    ShaderVariant variant = options.shader;
+    variant.fbmVolume = fbmTex != 0;
+    variant.noise4d = noiseRing != nullptr;
+    variant.loop = options.loopSeconds > 0.0f;
+    variant.analyticNoise = analyticNoise ? options.noise.period() : 0;
 
-    while (!glfwWindowShouldClose(window)) {
-        glfwPollEvents();
-        // --- Interactivity ---
-        // Space: pause toggle
-        if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS) {
-            if (!keySpacePressed) {
-                paused = !paused;
-                if (paused) baseTime = (float)glfwGetTime();
-                keySpacePressed = true;
+    // One fullscreen emitter unless a torch wall was requested
+    FireEmitters fires(caps.bufferStorage);
+    if (options.emitters > 0)
+        fires.emitters = makeTorchWall(options.emitters, options.mixedSchemes);
+    else
+        fires.emitters.push_back(FireEmitter());
+    variant.emitterSchemes = fires.usesOwnSchemes();
+    std::unique_ptr<TileClassifier> tiles;
+    // The classifier estimates the free-running scroll, not the rounded LOOP rates
+    if (options.tiles && options.emitters <= 1 && !noiseRing && !variant.loop)
+        tiles.reset(new TileClassifier());
+    std::unique_ptr<PostProcess> post;
+    if (options.blurRadius > 0.0f)
+        post.reset(new PostProcess(options.blurRadius));
+    std::unique_ptr<SparkParticles> sparks;
+    if (variant.sparks && options.sparkCount > 0 && !options.volume)
+        sparks.reset(new SparkParticles(options.sparkCount, fires, variant.analyticNoise));
+    RenderGraph graph;
+
+    if (offscreen) {
+        glfwSwapInterval(0);
+        int result = options.bench
+            ? runBenchmark(options, shaders, variant, fires, tiles.get(), post.get(), sparks.get(),
+                           noiseRing.get(), graph, vao, noiseTex, fbmTex)
+            : runExport(options, shaders, variant, fires, tiles.get(), post.get(), sparks.get(),
+                        noiseRing.get(), graph, vao, noiseTex, fbmTex);
+        graph.clear();
+        tiles.reset();
+        post.reset();
+        sparks.reset();
+        noiseRing.reset();
+        glState.deleteTextures(1, &noiseTex);
+        glState.deleteTextures(1, &fbmTex);
+        glState.deleteVertexArrays(1, &vao);
+        fires.clear();
+        shaders.clear();
+        glfwTerminate();
+        return result;
+    }
+
+    // Only the first frame's program is built up front; the variants reachable
+    // with C and F are built one per frame after it is on screen
+    int firstTileClass = tiles ? 1 : 0, lastTileClass = tiles ? 3 : 0;
+    for (int tileClass = firstTileClass; tileClass <= lastTileClass; ++tileClass) {
+        ShaderVariant v = variant;
+        v.tileClass = tileClass;
+        shaders.get(v);
+    }
+    for (int fbm = 0; fbm < (fbmTex ? 2 : 1); ++fbm) {
+        for (int scheme = 0; scheme < 3; ++scheme) {
+            for (int tileClass = firstTileClass; tileClass <= lastTileClass; ++tileClass) {
+                ShaderVariant v = variant;
+                v.colorScheme = scheme;
+                v.fbmVolume = fbm == (variant.fbmVolume ? 0 : 1);
+                v.tileClass = tileClass;
+                shaders.prefetch(v);
             }
         }
-        else {
-            keySpacePressed = false;
-        }
+    }
+
+    const GLFWvidmode* videoMode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+    double refreshHz = videoMode ? videoMode->refreshRate : 60.0;
+    FrameProfiler profiler(refreshHz);
+    FramePacer pacer(options.present, options.fpsLimit > 0.0 ? options.fpsLimit : refreshHz, options.presentLatency);
+    double presentMs = -1.0;
 
-        // +/-: speed control
-        if (glfwGetKey(window, GLFW_KEY_EQUAL) == GLFW_PRESS ||
-            glfwGetKey(window, GLFW_KEY_KP_ADD) == GLFW_PRESS) {
-            speed = std::min(speed + 0.1f, 3.0f);
+    // Reduced-resolution rendering
+    std::unique_ptr<TemporalUpscaler> upscaler;
+    if (options.renderScale < 1.0f || options.autoQuality)
+        upscaler.reset(new TemporalUpscaler());
+    RenderScaleController scaleController;
+    scaleController.targetMs = options.targetMs > 0.0 ? options.targetMs : 0.9 * 1000.0 / refreshHz;
+    bool upscaling = false;
+
+    // Quality governor; its cheapest noise knob is an R8 copy of the float volume
+    std::unique_ptr<QualityGovernor> governor;
+    GLuint noiseTexLow = 0;
+    if (options.autoQuality) {
+        NoiseFormat format = options.noise.format;
+        if (noiseTex && !fbmTex && (format == NoiseFormat::R32F || format == NoiseFormat::R16F)) {
+            NoiseSettings low = options.noise;
+            low.format = NoiseFormat::R8;
+            if (!options.cacheDir.empty())
+                noiseTexLow = loadNoiseTextureFromCache(options.cacheDir, low);
+            if (!noiseTexLow)
+                noiseTexLow = create3DNoiseTextureGPU(low, caps, vao);
+        }
+        governor.reset(new QualityGovernor(variant, noiseTexLow != 0, scaleController.targetMs));
+        std::cout << "Quality governor: " << governor->levelCount() << " levels, target "
+                  << scaleController.targetMs << " ms GPU" << std::endl;
+    }
+    // Neighbouring levels are built ahead so that a change does not stall on the compiler
+    auto prefetchLevel = [&](int level) {
+        if (!governor || level < 0 || level >= governor->levelCount()) return;
+        for (int tileClass = firstTileClass; tileClass <= lastTileClass; ++tileClass) {
+            ShaderVariant v = governor->apply(variant, level);
+            v.tileClass = tileClass;
+            shaders.prefetch(v);
         }
-        if (glfwGetKey(window, GLFW_KEY_MINUS) == GLFW_PRESS ||
-            glfwGetKey(window, GLFW_KEY_KP_SUBTRACT) == GLFW_PRESS) {
-            speed = std::max(speed - 0.1f, 0.1f);
+    };
+    prefetchLevel(1);
+    float lastShaderTime = 0.0f;
+    std::unique_ptr<LoopCache> loopCache;
+    if (options.loopCacheFps > 0.0f)
+        loopCache.reset(new LoopCache(options.loopSeconds, options.loopCacheFps));
+    std::unique_ptr<VolumeFire> volume;
+    if (options.volume) {
+        volume.reset(new VolumeFire());
+        volume->setNoise(noiseTex, vao);
+    }
+
+    // Interactive state, changed by the window callbacks
+    RenderState state;
+    state.colorScheme = variant.colorScheme;
+    state.fbmVolume = variant.fbmVolume;
+    state.fbmAvailable = fbmTex != 0;
+    state.orbitEnabled = volume != nullptr;
+    state.attach(window);
+    double lastFrameTime = glfwGetTime();
+
+    // Further output windows share the noise volume and programs of this context
+    std::vector<std::unique_ptr<OutputWindow>> outputs;
+    for (int i = 1; i < options.windows; ++i) {
+        std::unique_ptr<OutputWindow> output(new OutputWindow(i, window, options, caps, variant.analyticNoise));
+        if (!output->ok()) {
+            std::cerr << "Failed to create output window " << i + 1 << std::endl;
+            break;
         }
+        state.attach(output->handle());
+        outputs.push_back(std::move(output));
+    }
+    makeContextCurrent(window);
+    if (!outputs.empty())
+        std::cout << "Output windows: " << outputs.size() + 1 << ", time offset " << options.windowTimeOffset
+                  << " s" << std::endl;
+    OutputFrame outputFrame;
+    outputFrame.shaders = &shaders;
+    outputFrame.post = post.get();
+    outputFrame.loopSeconds = options.loopSeconds;
+    // Draws every output window after the main one and returns to the main context
+    auto showOutputs = [&](bool idle, bool exposed) {
+        if (outputs.empty()) return;
+        outputFrame.noiseTex = noiseTex;
+        outputFrame.fbmTex = fbmTex;
+        outputFrame.paused = state.paused;
+        for (auto& output : outputs)
+            output->show(outputFrame, idle, exposed);
+        // A closed output goes away on its own; the main window ends the program
+        outputs.erase(std::remove_if(outputs.begin(), outputs.end(), [](const std::unique_ptr<OutputWindow>& output) {
+            return glfwWindowShouldClose(output->handle());
+        }), outputs.end());
+        makeContextCurrent(window);
+    };
 
-        // C: color mode toggle
-        if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS) {
-            if (!keyCPressed) {
-                colorMode = (colorMode + 1) % 3;
-                keyCPressed = true;
+    // Idle frame reuse: after the paused frame settles, nothing is rendered until
+    // something changes; temporal accumulation needs a few frames to converge
+    FrameCache frameCache;
+    const int settleFrames = upscaler || volume ? 32 : 1;
+    int staticFrames = 0;
+    int shownWidth = 0, shownHeight = 0;
+    int shownGeneration = 0;
+    auto pollShaders = [&]() {
+        // Shader hot reload; the old programs keep rendering until the new ones link
+        if (shaderWatcher.changed()) {
+            ShaderSources changed;
+            if (shaderWatcher.load(changed)) {
+                std::cout << "Shaders changed, rebuilding" << std::endl;
+                shaders.reload(changed);
             }
         }
-        else {
-            keyCPressed = false;
+        shaders.update();
+    };
+
+    while (!glfwWindowShouldClose(window)) {
+        // Pace before the input is read, so the frame shows the latest input
+        double latencyMs = pacer.beginFrame();
+        if (latencyMs >= 0.0) {
+            profiler.presented(latencyMs);
+            presentMs = latencyMs;
         }
+        // Nothing moves while paused, so wait for an event instead of spinning
+        if (state.paused && !state.held() && !noiseStreamer)
+            glfwWaitEventsTimeout(RenderState::idleWaitSeconds);
+        else
+            glfwPollEvents();
 
-        // R: reset
-        if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS) {
-            if (!keyRPressed) {
-                speed = 1.0f;
-                colorMode = 0;
-                paused = false;
-                keyRPressed = true;
-            }
+        // --- Interactivity ---
+        double frameStart = glfwGetTime();
+        state.update((float)std::min(frameStart - lastFrameTime, 0.1));
+        lastFrameTime = frameStart;
+        bool changed = state.dirty;
+        if (state.dirty) {
+            variant.colorScheme = state.colorScheme;
+            variant.fbmVolume = state.fbmVolume && fbmTex != 0;
+            if (volume) volume->setColorScheme(state.colorScheme);
+            state.dirty = false;
         }
-        else {
-            keyRPressed = false;
+        if (state.profileRequested) {
+            profiler.dump(options.profilePath);
+            state.profileRequested = false;
+        }
+
+        // --- Idle frame reuse ---
+        int fbWidth, fbHeight;
+        glfwGetFramebufferSize(window, &fbWidth, &fbHeight);
+        bool unchanged = state.paused && !changed && !noiseStreamer && fbWidth == shownWidth &&
+                         fbHeight == shownHeight && shaders.sourceGeneration() == shownGeneration;
+        staticFrames = unchanged ? staticFrames + 1 : 0;
+        if (staticFrames >= settleFrames) {
+            // The last swap still shows the frame; re-present only if the window lost it
+            if (state.exposed && frameCache.present(fbWidth, fbHeight))
+                glfwSwapBuffers(window);
+            showOutputs(true, state.exposed);
+            state.exposed = false;
+            pollShaders();
+            continue;
         }
+        bool exposed = state.exposed;
+        state.exposed = false;
+
+        // --- Streamed noise upload ---
+        // Ahead of profiler.beginFrame(): createFBMVolume opens its own GL_TIME_ELAPSED query
+        if (noiseStreamer && noiseStreamer->update(NoiseStreamer::frameBudgetMs)) {
+            glState.deleteTextures(1, &noiseTex);
+            noiseTex = noiseStreamer->release();
+            noiseStreamer.reset();
+            if (loopCache) loopCache->invalidate();
+            if (volume) volume->setNoise(noiseTex, vao);
+            if (fbmTex) {
+                glState.deleteTextures(1, &fbmTex);
+                fbmTex = createFBMVolume(noiseTex, options.noise, vao);
+            }
+        }
+
+        profiler.beginFrame();
 
         // --- Render ---
-        glClear(GL_COLOR_BUFFER_BIT);
-        glUseProgram(shader);
+        outputFrame.variant = variant;
+        float time = state.paused ? state.baseTime : (float)glfwGetTime();
+        float shaderTime = time * state.speed;
+        if (variant.loop)
+            shaderTime = std::fmod(shaderTime, options.loopSeconds);
+        // A loop restart continues the animation, it does not rewind it
+        float shaderDelta = shaderTime - lastShaderTime;
+        if (variant.loop && shaderDelta < 0.0f) shaderDelta += options.loopSeconds;
+        lastShaderTime = shaderTime;
+        if (loopCache) {
+            uint64_t key = (uint64_t)shaders.sourceGeneration() << 32 | variant.key();
+            if (!loopCache->valid(key, fbWidth, fbHeight)) {
+                float previousFrame = 0.0f;
+                loopCache->record(key, fbWidth, fbHeight, [&](float frameTime, GLuint target) {
+                    const float noJitter[2] = { 0.0f, 0.0f };
+                    graph.reset();
+                    RenderGraph::Target output = graph.importTarget(target, fbWidth, fbHeight);
+                    RenderGraph::Target scene = post ? graph.createTarget(fbWidth, fbHeight, PostProcess::sceneFormat) : output;
+                    graph.addPass({}, scene, firePassLoad(fires), [&] {
+                        glState.activeTexture(GL_TEXTURE1);
+                        glState.bindTexture(GL_TEXTURE_3D, fbmTex);
+                        glState.activeTexture(GL_TEXTURE0);
+                        glState.bindTexture(GL_TEXTURE_3D, noiseTex);
+                        drawFires(fires, shaders, variant, nullptr, frameTime, noJitter, vao, 0.0f, options.loopSeconds);
+                    });
+                    if (sparks && variant.sparks) {
+                        graph.addPass({}, scene, RenderGraph::Load::Keep, [&] {
+                            // Run one cycle first so that the recording starts in steady state
+                            if (frameTime == 0.0f) {
+                                float step = 1.0f / options.loopCacheFps;
+                                for (float t = 0.0f; t < options.loopSeconds; t += step)
+                                    sparks->update(fires, t, step, options.loopSeconds);
+                                previousFrame = -step;
+                            }
+                            sparks->update(fires, frameTime, frameTime - previousFrame, options.loopSeconds);
+                            sparks->draw(fires, frameTime, fbHeight, options.loopSeconds);
+                            previousFrame = frameTime;
+                        });
+                    }
+                    if (post) post->addPasses(graph, scene, output, vao);
+                    graph.execute();
+                });
+            }
+        }
 
-        float time = paused ? baseTime : (float)glfwGetTime();
-        glUniform1f(timeLoc, time * speed);
-        glUniform1i(colorModeLoc, colorMode);
+        graph.reset();
+        RenderGraph::Target backbuffer = graph.importTarget(0, fbWidth, fbHeight);
+        RenderGraph::Target scene = post && !loopCache ? graph.createTarget(fbWidth, fbHeight, PostProcess::sceneFormat)
+                                                       : backbuffer;
+        if (loopCache) {
+            graph.addPass({}, backbuffer, RenderGraph::Load::Overwrite, [&] { loopCache->play(shaderTime, vao); });
+        }
+        else if (volume) {
+            graph.addPass({}, scene, RenderGraph::Load::Overwrite, [&] {
+                glState.activeTexture(GL_TEXTURE0);
+                glState.bindTexture(GL_TEXTURE_3D, noiseTex);
+                volume->draw(state.camera, shaderTime, fbWidth, fbHeight, vao, graph.framebuffer(scene));
+            });
+        }
+        else {
+            float uvOffset[2] = { 0.0f, 0.0f };
+            if (governor && governor->update(profiler.latestGpuMs())) {
+                std::cout << "Quality " << governor->level() << "/" << governor->levelCount() - 1 << ": "
+                          << governor->current().describe() << " (GPU " << std::fixed << std::setprecision(1)
+                          << governor->lastMs() << " ms, target " << scaleController.targetMs << " ms)"
+                          << std::defaultfloat << std::endl;
+                prefetchLevel(governor->level() - 1);
+                prefetchLevel(governor->level() + 1);
+            }
+            float scale = 1.0f;
+            if (governor) {
+                scale = governor->current().scale;
+            }
+            else if (upscaler) {
+                if (options.renderScale <= 0.0f)
+                    scaleController.update(profiler.latestGpuMs());
+                scale = options.renderScale > 0.0f ? options.renderScale : scaleController.scale;
+            }
+            // The governor runs at full resolution without the upscaler
+            bool upscale = upscaler && (scale < 1.0f || !governor);
+            if (upscale) {
+                if (!upscaling) upscaler->invalidateHistory();
+                upscaler->begin(fbWidth, fbHeight, scale, uvOffset);
+            }
+            upscaling = upscale;
+            RenderGraph::Target fireTarget = upscale
+                ? graph.createTarget(fbWidth, fbHeight, TemporalUpscaler::reducedFormat) : scene;
+            ShaderVariant drawVariant = governor ? governor->apply(variant) : variant;
+            outputFrame.variant = drawVariant;
+            graph.addPass({}, fireTarget, firePassLoad(fires), [&] {
+                if (upscale) upscaler->setReducedViewport();
+                glState.activeTexture(GL_TEXTURE1);
+                glState.bindTexture(GL_TEXTURE_3D, fbmTex);
+                glState.activeTexture(GL_TEXTURE0);
+                glState.bindTexture(GL_TEXTURE_3D, governor && governor->current().lowNoise ? noiseTexLow : noiseTex);
+                float noiseBlend = noiseRing ? noiseRing->update(shaderTime) : 0.0f;
+                drawFires(fires, shaders, drawVariant, tiles.get(), shaderTime, uvOffset, vao, noiseBlend, options.loopSeconds);
+            });
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_3D, noiseTex);
-        glBindVertexArray(vao);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
+            // The fire scrolls with p.y = uv.y * 2.5 + time * 0.2
+            if (upscale)
+                upscaler->addResolve(graph, fireTarget, scene, shaderDelta * 0.2f / 2.5f, vao);
+            // Sparks are points, so they skip the reduced-resolution pass
+            if (sparks && drawVariant.sparks) {
+                graph.addPass({}, scene, RenderGraph::Load::Keep, [&] {
+                    sparks->update(fires, shaderTime, shaderDelta, options.loopSeconds);
+                    sparks->draw(fires, shaderTime, fbHeight, options.loopSeconds);
+                });
+            }
+        }
+        if (post && !loopCache) post->addPasses(graph, scene, backbuffer, vao);
+        graph.execute();
 
         // FPS counter update
         frameCount++;
@@ -390,19 +6276,51 @@ int main() {
         if (deltaTime >= 0.5) { // Update every 0.5 seconds
             double fps = frameCount / deltaTime;
             std::string title = "Fire & Smoke (Interactive) | FPS: " + std::to_string(int(fps));
+            if (governor)
+                title += " | quality " + std::to_string(governor->level()) + "/" + std::to_string(governor->levelCount() - 1);
+            else if (upscaler && options.renderScale <= 0.0f)
+                title += " | scale " + std::to_string(int(scaleController.scale * 100.0f + 0.5f)) + "%";
+            if (presentMs >= 0.0)
+                title += " | latency " + std::to_string(int(presentMs + 0.5)) + " ms";
             glfwSetWindowTitle(window, title.c_str());
             frameCount = 0;
             lastTime = currentTime;
         }
 
+        if (state.paused)
+            frameCache.store(fbWidth, fbHeight);
+        shownWidth = fbWidth;
+        shownHeight = fbHeight;
+        shownGeneration = shaders.sourceGeneration();
+        profiler.endFrame();
         glfwSwapBuffers(window);
+        pacer.endFrame();
+        outputFrame.time = shaderTime;
+        outputFrame.delta = shaderDelta;
+        showOutputs(false, exposed);
+        pollShaders();
     }
+    if (options.profileOnExit)
+        profiler.dump(options.profilePath);
 
     // Cleanup
-    glDeleteTextures(1, &noiseTex);
-    glDeleteVertexArrays(1, &vao);
-    glDeleteBuffers(1, &vbo);
-    glDeleteProgram(shader);
+    outputs.clear();
+    makeContextCurrent(window);
+    noiseStreamer.reset();
+    loopCache.reset();
+    volume.reset();
+    upscaler.reset();
+    graph.clear();
+    tiles.reset();
+    post.reset();
+    sparks.reset();
+    noiseRing.reset();
+    glState.deleteTextures(1, &noiseTex);
+    glState.deleteTextures(1, &noiseTexLow);
+    glState.deleteTextures(1, &fbmTex);
+    glState.deleteVertexArrays(1, &vao);
+    fires.clear();
+    shaders.clear();
     glfwTerminate();
     return 0;
 }
\ No newline at end of file
@@ -1,8 +1,112 @@
-#version 450 core
-layout(location = 0) in vec3 aPos;
-layout(location = 1) in vec2 aTex;
-out vec2 TexCoords;
+#version 330 core
+// Fire + smoke composition. Project.cpp inserts the variant #defines after the
+// #version line: COLOR_SCHEME, FBM_OCTAVES, DISTORTION, FBM_VOLUME,
+// EMITTER_SCHEMES, TILE_CLASS, NOISE_4D, LOOP, ANALYTIC_NOISE, followed by
+// hashNoise() (analyticNoiseGLSL), the in-shader noise used when ANALYTIC_NOISE != 0.
+// Edits are picked up while the app runs (see --shader-dir).
+out vec4 FragColor;
+in vec2 uv;
+in float fireTime;
+flat in int emitterScheme;
+flat in float firePeriod;           // LOOP: fireTime of one cycle
+uniform sampler3D noiseTex;
+uniform sampler3D fbmTex;
+uniform sampler3D noiseTexNext;     // NOISE_4D: the time slice after noiseTex
+layout(std140) uniform FrameData {
+    vec2 uvOffset;
+    vec2 tileSize;
+    float time;
+    float noiseBlend;               // NOISE_4D: position between the two slices
+    float loopLength;
+};
+
+float noiseAt(vec3 p) {
+    if (ANALYTIC_NOISE != 0) return hashNoise(p);
+    if (NOISE_4D != 0) return mix(texture(noiseTex, p).r, texture(noiseTexNext, p).r, noiseBlend);
+    return texture(noiseTex, p).r;
+}
+
+// FBM with more octaves for detail
+float fbm(vec3 p) {
+    if (FBM_VOLUME != 0) return texture(fbmTex, p).r;
+    float v = 0.0;
+    float a = 0.5;
+    for (int i = 0; i < FBM_OCTAVES; i++) {
+        v += a * noiseAt(p);
+        p *= 2.0;
+        a *= 0.5;
+    }
+    return v;
+}
+
+// LOOP: rounds a scroll rate (per unit of t) so that one cycle moves the volume
+// by a whole number of periods; with GL_REPEAT the cycle ends where it began
+float loopRate(float rate) {
+    if (LOOP == 0) return rate;
+    float cycle = firePeriod * 0.2;
+    return sign(rate) * max(1.0, floor(abs(rate) * cycle + 0.5)) / cycle;
+}
+
+vec3 getFireColor(float fire) {
+    int scheme = (EMITTER_SCHEMES != 0 && emitterScheme >= 0) ? emitterScheme : COLOR_SCHEME;
+    if (scheme == 1) {
+        return mix(vec3(0.8, 0.1, 0.0), vec3(1.0, 0.4, 0.0), fire * 2.0);
+    }
+    else if (scheme == 2) {
+        return mix(vec3(0.0, 0.2, 0.8), vec3(0.2, 0.8, 1.0), fire * 2.0);
+    }
+    else {
+        return mix(vec3(1.0, 0.4, 0.0), vec3(1.0, 1.0, 0.2), fire * 2.0);
+    }
+}
+
 void main() {
-    TexCoords = aTex;
-    gl_Position = vec4(aPos, 1.0);
-}
\ No newline at end of file
+    float t = fireTime * 0.2;
+    // 4D noise evolves through its time slices, so z no longer scrolls
+    float zt = NOISE_4D != 0 ? 0.0 : t;
+    vec3 p = vec3(uv.x * 1.5, uv.y * 2.5 + t * loopRate(1.0), zt * loopRate(0.5));
+
+    float smoke = smoothstep(0.4, 0.9, fbm(p + vec3(0.0, 1.0, NOISE_4D != 0 ? 0.5 : -t * loopRate(0.2))));
+    vec3 colSmoke = mix(vec3(0.1), vec3(0.4), smoke);
+    vec3 finalColor = colSmoke;
+
+    // Smoke-only tiles (TILE_CLASS 1) lie where heightMask is 1
+    if (TILE_CLASS != 1) {
+        // The FBM volume keeps the distortion fields (fbm shifted by 0.5 in x / y)
+        // in G and B, so fire and distortion come from a single fetch.
+        // Calm tiles (TILE_CLASS 2) have too little fire to distort anything.
+        bool distort = DISTORTION != 0 && TILE_CLASS != 2;
+        vec3 fireNoise;
+        if (FBM_VOLUME != 0) {
+            fireNoise = texture(fbmTex, p).rgb;
+        }
+        else if (!distort) {
+            fireNoise = vec3(fbm(p), 0.5, 0.5);
+        }
+        else {
+            fireNoise = vec3(fbm(p), fbm(p + vec3(0.5, 0.0, zt * loopRate(0.3))), fbm(p + vec3(0.0, 0.5, zt * loopRate(0.3))));
+        }
+
+        float fire = pow(fireNoise.r, 3.0);
+        float heightMask = smoothstep(0.2, 1.0, uv.y);
+
+        // --- Heat Distortion ---
+        // Distort UV based on fire intensity and gradient
+        vec2 distortion = (fireNoise.gb - 0.5) * fire * 0.03; // scale distortion
+
+        vec2 distortedUV = uv + distortion;
+
+        // Recompute fire with distorted UV for consistency
+        float fireDistorted = fire;
+        if (distort) {
+            vec3 pDistorted = vec3(distortedUV.x * 1.5, distortedUV.y * 2.5 + t * loopRate(1.0), zt * loopRate(0.5));
+            fireDistorted = pow(fbm(pDistorted), 3.0);
+        }
+        vec3 colFire = getFireColor(fireDistorted);
+
+        // --- Smoke ---
+        finalColor = mix(colFire, colSmoke, heightMask);
+    }
+
+    FragColor = vec4(finalColor, 1.0);
+}
@@ -1,12 +1,39 @@
-#version 450 core
-out vec4 FragColor;
-in vec2 TexCoords;
-uniform sampler3D noiseTex;
-uniform float time;
+#version 330 core
+layout(location = 1) in vec4 emitterRect;     // centre.xy, half size.xy (NDC)
+layout(location = 2) in vec4 emitterParams;   // seed offset, speed, colour scheme (-1 = COLOR_SCHEME)
+out vec2 uv;
+out float fireTime;
+flat out int emitterScheme;
+flat out float firePeriod;
+// Per-frame values, written once per frame through UniformRing (FrameData in Project.cpp)
+layout(std140) uniform FrameData {
+    vec2 uvOffset;      // sub-pixel jitter of the reduced-resolution pass
+    vec2 tileSize;      // TILE_CLASS != 0: tile extent in the emitter's [-1, 1] quad space
+    float time;
+    float noiseBlend;   // NOISE_4D: position between the two slices
+    float loopLength;   // LOOP: length of one cycle of time
+};
+uniform usampler2D tileClasses;     // TILE_CLASS != 0: one instance per tile of the emitter
+// The two triangles of the quad come from gl_VertexID, so no vertex buffer is bound
+const vec2 quadCorners[6] = vec2[6](vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(-1.0, 1.0),
+                                    vec2(1.0, -1.0), vec2(1.0, 1.0), vec2(-1.0, 1.0));
 void main() {
-    vec3 coord = vec3(TexCoords, time * 0.1);
-    float n = texture(noiseTex, coord).r;
-    vec3 fireColor = mix(vec3(1.0, 0.5, 0.0), vec3(1.0, 1.0, 1.0), n);
-    float alpha = n * n;
-    FragColor = vec4(fireColor, alpha);
-}
\ No newline at end of file
+    vec2 pos = quadCorners[gl_VertexID];
+    vec2 corner = pos;
+    if (TILE_CLASS != 0) {
+        int columns = textureSize(tileClasses, 0).x;
+        ivec2 tile = ivec2(gl_InstanceID % columns, gl_InstanceID / columns);
+        // Tiles of the other classes collapse outside the clip volume
+        if (int(texelFetch(tileClasses, tile, 0).r) != TILE_CLASS) {
+            gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+            return;
+        }
+        corner = min(-1.0 + (vec2(tile) + pos * 0.5 + 0.5) * tileSize, vec2(1.0));
+    }
+    // The jitter is in fullscreen uv units; a smaller quad stretches its uv
+    uv = corner * 0.5 + 0.7 + uvOffset / emitterRect.zw + vec2(emitterParams.x, 0.0);
+    fireTime = time * emitterParams.y;
+    firePeriod = loopLength * emitterParams.y;
+    emitterScheme = int(emitterParams.z);
+    gl_Position = vec4(emitterRect.xy + corner * emitterRect.zw, 0.0, 1.0);
+}